@@ -0,0 +1,113 @@
+#ifdef __BENCH_HEAD
+#   error "bench.hpp header can't be included several times"
+#else
+#   define __BENCH_HEAD
+#endif
+
+// LCOV_EXCL_START
+
+#include <string>
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <atomic>
+#include <cstdlib>
+#include <cstdarg>
+#include <new>
+
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+
+namespace benches {
+
+std::atomic<std::size_t> allocations = 0;
+// Receive syscalls of the threads that count them, load generators of
+// a benchmark turn counting off to leave only the code under test
+std::atomic<std::size_t> read_syscalls = 0;
+std::atomic<std::size_t> ioctl_syscalls = 0;
+thread_local bool count_syscalls = true;
+
+struct {
+    std::chrono::milliseconds min_time = std::chrono::milliseconds(500);
+    template <typename F>
+    void measure(const std::string & name, F fun) {
+        using namespace std::chrono;
+        fun(); // warm up
+        std::size_t iterations = 0;
+        std::size_t allocs = allocations;
+        auto start = steady_clock::now();
+        auto end = start;
+        for (std::size_t batch = 1; end - start < min_time; batch *= 2) {
+            for (std::size_t i = 0; i < batch; i++)
+                fun();
+            iterations += batch;
+            end = steady_clock::now();
+        }
+        allocs = allocations - allocs;
+        double ns = duration_cast<nanoseconds>(end - start).count() / double(iterations);
+        std::cout << std::left << std::setw(40) << name << std::right
+            << std::setw(12) << std::fixed << std::setprecision(1) << ns << " ns/op"
+            << std::setw(10) << std::setprecision(2) << allocs / double(iterations) << " allocs/op"
+            << std::endl;
+    }
+} runner;
+
+template <typename T>
+inline void keep(T && value) {
+    asm volatile("" : : "g"(&value) : "memory");
+}
+
+}
+
+#define bench \
+        void bench_function()
+
+#define measure(name, fun) \
+        ::benches::runner.measure(name, [&]() fun)
+
+void * operator new(std::size_t size) {
+    benches::allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void * ptr = std::malloc(size ? size : 1))
+        return ptr;
+    throw std::bad_alloc();
+}
+
+void operator delete(void * ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void * ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
+
+extern "C" ssize_t read(int fd, void * buf, size_t count) {
+    if (benches::count_syscalls)
+        benches::read_syscalls.fetch_add(1, std::memory_order_relaxed);
+    return syscall(SYS_read, fd, buf, count);
+}
+
+extern "C" ssize_t recv(int fd, void * buf, size_t count, int flags) {
+    if (benches::count_syscalls)
+        benches::read_syscalls.fetch_add(1, std::memory_order_relaxed);
+    return syscall(SYS_recvfrom, fd, buf, count, flags, nullptr, nullptr);
+}
+
+extern "C" int ioctl(int fd, unsigned long request, ...) {
+    va_list args;
+    va_start(args, request);
+    void * arg = va_arg(args, void *);
+    va_end(args);
+    if (benches::count_syscalls)
+        benches::ioctl_syscalls.fetch_add(1, std::memory_order_relaxed);
+    return int(syscall(SYS_ioctl, fd, request, arg));
+}
+
+void bench_function();
+
+int main() {
+    std::cout << "entering benchmark..." << std::endl;
+    bench_function();
+}
+
+// LCOV_EXCL_STOP
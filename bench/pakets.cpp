@@ -0,0 +1,61 @@
+#include "bench.hpp"
+
+#include <filesystem>
+#include <fstream>
+
+#include <unistd.h>
+
+#include <ekutils/socket_d.hpp>
+
+#include "mc_pakets.hpp"
+#include "client.hpp"
+#include "settings.hpp"
+#include "prog_args.hpp"
+
+namespace fs = std::filesystem;
+
+bench {
+	using namespace mcshub;
+	pakets::handshake hs;
+	hs.version() = 578;
+	hs.address() = "lobby.mc.handtruth.com";
+	hs.port() = 25565;
+	hs.state() = 2;
+	byte_t bytes[256];
+	int size = hs.write(bytes, sizeof(bytes));
+
+	measure("handshake write", {
+		benches::keep(hs.write(bytes, sizeof(bytes)));
+	});
+	pakets::handshake parsed;
+	measure("handshake read", {
+		benches::keep(parsed.read(bytes, std::size_t(size)));
+	});
+	std::int32_t id, length;
+	measure("pakets::head", {
+		benches::keep(pakets::head(bytes, std::size_t(size), length, id));
+	});
+
+	// gate::head() checks max_packet_size of the published configuration
+	fs::path dir = fs::temp_directory_path() / ("mcshub-bench-" + std::to_string(getpid()));
+	fs::create_directory(dir);
+	fs::current_path(dir);
+	std::ofstream(arguments.confname) << "max_packet_size: 6000\n";
+	reload_configuration();
+
+	// Handshake waits in the input buffer of a gate like after receive
+	ekutils::tcp_listener_d listener;
+	listener.listen("127.0.0.1", 0);
+	listener.start();
+	ekutils::tcp_socket_d client(ekutils::connection_info::resolve("127.0.0.1", listener.local_endpoint().port()));
+	gate server(listener.accept());
+	client.write(bytes, std::size_t(size));
+	while (server.avail_read() < std::size_t(size))
+		server.receive();
+	measure("gate::head (complete handshake)", {
+		benches::keep(server.head(id, length));
+	});
+
+	fs::current_path(dir.parent_path());
+	fs::remove_all(dir);
+}
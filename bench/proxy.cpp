@@ -0,0 +1,302 @@
+#include "bench.hpp"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include <ekutils/log.hpp>
+#include <ekutils/socket_d.hpp>
+
+#include "thread_controller.hpp"
+#include "client.hpp"
+#include "settings.hpp"
+#include "prog_args.hpp"
+#include "sclient.hpp"
+#include "logging.hpp"
+
+// End-to-end benchmark: MCSHub workers of this process proxy synthetic
+// clients to a local fake backend over loopback.
+
+namespace fs = std::filesystem;
+using namespace std::chrono;
+
+namespace {
+
+using namespace mcshub;
+
+constexpr unsigned clients = 32;
+constexpr auto period = seconds(2);
+constexpr std::size_t chunk = 16384;
+const std::string ready = "ready";
+
+// Answers status requests and echoes packets after the login
+class fake_backend {
+	ekutils::tcp_listener_d listener;
+	std::thread acceptor;
+	std::mutex mutex;
+	std::vector<std::thread> peers;
+	std::atomic<bool> working { true };
+
+	static void serve(ekutils::tcp_socket_d && sock) {
+		benches::count_syscalls = false;
+		try {
+			sclient peer(std::move(sock));
+			peer.set_timeout(seconds(10));
+			pakets::handshake hs;
+			peer.read_paket(hs);
+			if (hs.state() == 1) {
+				pakets::request request;
+				peer.read_paket(request);
+				pakets::response response;
+				response.message() = R"({"version":{"name":"bench","protocol":578},"players":{"max":100,"online":0},"description":{"text":"fake backend"}})";
+				peer.write_paket(response);
+				return;
+			}
+			pakets::login login;
+			peer.read_paket(login);
+			pakets::response message;
+			message.message() = ready;
+			peer.write_paket(message);
+			while (true) {
+				peer.read_paket(message);
+				peer.write_paket(message);
+			}
+		} catch (const std::exception &) {
+			// Client has gone
+		}
+	}
+
+public:
+	fake_backend() {
+		listener.listen("127.0.0.1", 0);
+		listener.start(128);
+		acceptor = std::thread([this]() {
+			benches::count_syscalls = false;
+			while (true) {
+				ekutils::tcp_socket_d sock = listener.accept();
+				if (!working)
+					return;
+				std::lock_guard lock(mutex);
+				peers.emplace_back(serve, std::move(sock));
+			}
+		});
+	}
+	~fake_backend() {
+		working = false;
+		// Wake up the acceptor
+		ekutils::tcp_socket_d wake(ekutils::connection_info::resolve("127.0.0.1", port()));
+		acceptor.join();
+		for (auto & peer : peers)
+			peer.join();
+	}
+	std::uint16_t port() const {
+		return listener.local_endpoint().port();
+	}
+};
+
+void configure(unsigned workers, std::uint16_t backend, bool splice = true) {
+	std::ofstream file(arguments.confname);
+	file << "port: 0\n"
+		"threads: " << workers << "\n"
+		"splice: " << (splice ? "true" : "false") << "\n"
+		"servers:\n"
+		"  backend:\n"
+		"    address: 127.0.0.1\n"
+		"    port: " << backend << '\n';
+}
+
+// Fake server has no record, the default one answers
+void handshake(sclient & client, int state, std::uint16_t port, bool fake = false) {
+	pakets::handshake hs;
+	hs.version() = 578;
+	hs.address() = fake ? "fake" : "backend";
+	hs.port() = port;
+	hs.state() = state;
+	client.write_paket(hs);
+}
+
+// Calls the action from every client thread until the time is over,
+// returns the number of completed actions
+template <typename F>
+std::size_t load(F action) {
+	std::atomic<std::size_t> total = 0;
+	std::vector<std::thread> threads;
+	auto end = steady_clock::now() + period;
+	for (unsigned i = 0; i < clients; i++) {
+		threads.emplace_back([&total, &action, end, i]() {
+			benches::count_syscalls = false;
+			std::size_t done = 0;
+			try {
+				while (steady_clock::now() < end) {
+					action(i);
+					done++;
+				}
+			} catch (const std::exception & e) {
+				std::cerr << "client failed: " << e.what() << std::endl;
+			}
+			total += done;
+		});
+	}
+	for (auto & thread : threads)
+		thread.join();
+	return total;
+}
+
+std::unique_ptr<sclient> connect(const std::vector<ekutils::connection_info> & hub) {
+	auto client = std::make_unique<sclient>(ekutils::tcp_socket_d(hub));
+	client->set_timeout(seconds(10));
+	return client;
+}
+
+double per_second(std::size_t count) {
+	return count / duration<double>(period).count();
+}
+
+void report(const std::string & name, double value, const std::string & unit) {
+	std::cout << std::left << std::setw(40) << name << std::right
+		<< std::setw(12) << std::fixed << std::setprecision(1) << value << ' ' << unit << std::endl;
+}
+
+// Packets echoed through established tunnels, returns MB/s. Receive
+// syscalls of the workers are reported if the tunnels read into buffers.
+double echo(const std::vector<ekutils::connection_info> & hub, std::uint16_t port, const std::string & suffix = {}) {
+	std::vector<std::unique_ptr<sclient>> tunnels(clients);
+	for (unsigned i = 0; i < clients; i++) {
+		tunnels[i] = connect(hub);
+		handshake(*tunnels[i], 2, port);
+		pakets::login login;
+		login.name() = "streamer" + std::to_string(i);
+		tunnels[i]->write_paket(login);
+		pakets::response response;
+		tunnels[i]->read_paket(response);
+	}
+	pakets::response payload;
+	payload.message() = std::string(chunk, 'x');
+	std::size_t events = gate::receive_events, reads = benches::read_syscalls, ioctls = benches::ioctl_syscalls;
+	std::size_t echoes = load([&tunnels, &payload](unsigned i) {
+		pakets::response response;
+		tunnels[i]->write_paket(payload);
+		tunnels[i]->read_paket(response);
+	});
+	events = gate::receive_events - events;
+	reads = benches::read_syscalls - reads;
+	ioctls = benches::ioctl_syscalls - ioctls;
+	tunnels.clear();
+	if (events && !suffix.empty()) {
+		// FIONREAD path made an ioctl and a read on every event
+		double syscalls = double(reads + ioctls) / events;
+		report("receive syscalls/event" + suffix, syscalls, "");
+		report("saved syscalls/event" + suffix, 2 - syscalls, "");
+		report("saved syscalls" + suffix, per_second(2 * events) - per_second(reads + ioctls), "/s");
+	}
+	// Every echoed packet passes the hub in both directions
+	return per_second(echoes * 2 * chunk) / 1048576;
+}
+
+} // namespace
+
+bench {
+	// Only the hub workers count their syscalls
+	benches::count_syscalls = false;
+	ekutils::stdout_log log(ekutils::log_level::error);
+	ekutils::log = &log;
+	set_log_threshold(ekutils::log_level::error);
+	fs::path dir = fs::temp_directory_path() / ("mcshub-bench-" + std::to_string(getpid()));
+	fs::create_directory(dir);
+	fs::current_path(dir);
+
+	fake_backend backend;
+	unsigned hardware = std::max(1u, std::thread::hardware_concurrency());
+	bool initialized = false;
+	for (unsigned workers = 1; workers <= hardware && workers <= 8; workers *= 2) {
+		configure(workers, backend.port());
+		if (initialized) {
+			reload_configuration();
+		} else {
+			settings::initialize();
+			initialized = true;
+		}
+		thread_controller::real_port = 0;
+		thread_controller controller;
+		std::uint16_t port = thread_controller::real_port;
+		auto hub = ekutils::connection_info::resolve("127.0.0.1", port);
+		const std::string suffix = ", " + std::to_string(workers) + (workers == 1 ? " worker" : " workers");
+
+		// Status of a record without backend, served by MCSHub itself
+		std::size_t statuses = load([&hub, port](unsigned) {
+			auto client = connect(hub);
+			handshake(*client, 1, port, true);
+			client->write_paket(pakets::request());
+			pakets::response response;
+			client->read_paket(response);
+		});
+		report("fake status" + suffix, per_second(statuses), "req/s");
+
+		// Login to a record without backend, disconnected by MCSHub
+		std::size_t logins = load([&hub, port](unsigned i) {
+			auto client = connect(hub);
+			handshake(*client, 2, port, true);
+			pakets::login login;
+			login.name() = "faker" + std::to_string(i);
+			client->write_paket(login);
+			pakets::disconnect dc;
+			client->read_paket(dc);
+		});
+		report("fake login" + suffix, per_second(logins), "req/s");
+
+		// Status proxied to the backend
+		statuses = load([&hub, port](unsigned) {
+			connect(hub)->status("backend", port);
+		});
+		report("backend status" + suffix, per_second(statuses), "req/s");
+
+		// From connect to the first packet of the backend after the login
+		std::vector<std::vector<double>> latencies(clients);
+		load([&hub, &latencies, port](unsigned i) {
+			auto start = steady_clock::now();
+			auto client = connect(hub);
+			handshake(*client, 2, port);
+			pakets::login login;
+			login.name() = "bencher" + std::to_string(i);
+			client->write_paket(login);
+			pakets::response response;
+			client->read_paket(response);
+			latencies[i].push_back(duration_cast<duration<double, std::micro>>(steady_clock::now() - start).count());
+		});
+		std::vector<double> all;
+		for (auto & samples : latencies)
+			all.insert(all.end(), samples.begin(), samples.end());
+		std::sort(all.begin(), all.end());
+		if (!all.empty()) {
+			for (double q : { 0.5, 0.9, 0.99 }) {
+				double value = all[std::min(all.size() - 1, std::size_t(q * all.size()))];
+				report("login latency p" + std::to_string(int(q * 100)) + suffix, value, "us");
+			}
+		}
+
+		// Packets echoed through established tunnels
+		report("proxied throughput" + suffix, echo(hub, port), "MB/s");
+		controller.terminate();
+	}
+
+	// Tunnels that read into buffers: syscalls per receive event against
+	// the FIONREAD ioctl and read(2) of every event
+	configure(1, backend.port(), false);
+	reload_configuration();
+	{
+		thread_controller::real_port = 0;
+		thread_controller controller;
+		std::uint16_t port = thread_controller::real_port;
+		auto hub = ekutils::connection_info::resolve("127.0.0.1", port);
+		report("buffered throughput, 1 worker", echo(hub, port, ", buffered"), "MB/s");
+		controller.terminate();
+	}
+	fs::current_path(dir.parent_path());
+	fs::remove_all(dir);
+}
@@ -0,0 +1,69 @@
+#include "bench.hpp"
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include "settings.hpp"
+#include "record_route.hpp"
+
+bench {
+	using namespace mcshub;
+	std::unordered_map<std::string, settings::server_record> servers;
+	for (int i = 0; i < 10000; i++)
+		servers["server" + std::to_string(i)].port = 25565;
+	settings::server_record default_server;
+	const std::string domain = ".mc.handtruth.com";
+	route_table<settings::server_record> routes;
+	routes.build(servers, default_server, domain);
+	std::vector<std::string> addresses;
+	for (int i = 0; i < 10000; i += 7)
+		addresses.push_back("server" + std::to_string(i) + domain + (i % 2 ? "." : ""));
+	addresses.push_back(std::string("server42.mc.handtruth.com\0FML\0", 30));
+	addresses.push_back("unknown" + domain);
+	std::size_t n = 0;
+
+	measure("unordered_map lookup (10k records)", {
+		const std::string & address = addresses[n++ % addresses.size()];
+		std::string name = address.c_str();
+		if (name.back() == '.')
+			name.pop_back();
+		std::size_t name_sz = name.size();
+		if (name_sz > domain.size() && !name.compare(name_sz - domain.size(), domain.size(), domain))
+			name.resize(name_sz - domain.size());
+		auto iter = servers.find(name);
+		benches::keep(iter == servers.end() ? default_server : iter->second);
+	});
+	measure("route_table lookup (10k records)", {
+		const std::string & address = addresses[n++ % addresses.size()];
+		benches::keep(routes.find(address));
+	});
+
+	// Work of portal::record() for every handshake: route lookup, copy of
+	// the server name, statistics slot of the record and FML choice
+	for (int records : { 10000, 100000 }) {
+		std::unordered_map<std::string, settings::server_record> large;
+		for (int i = 0; i < records; i++) {
+			auto & record = large["server" + std::to_string(i)];
+			record.port = 25565;
+			if (i % 10 == 0)
+				record.fml = settings::basic_record();
+		}
+		route_table<settings::server_record> table;
+		table.build(large, default_server, domain);
+		std::vector<std::string> requested;
+		for (int i = 0; i < records; i += 97) {
+			std::string address = "server" + std::to_string(i) + domain;
+			if (i % 3 == 0)
+				address += std::string("\0FML\0", 5);
+			requested.push_back(address);
+		}
+		requested.push_back("unknown" + domain);
+		std::string server_name;
+		measure("portal::record path (" + std::to_string(records / 1000) + "k records)", {
+			auto route = route_record(table, default_server, requested[n++ % requested.size()], server_name);
+			benches::keep(route.stats);
+			benches::keep(route.record);
+		});
+	}
+}
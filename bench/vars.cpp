@@ -0,0 +1,86 @@
+#include "bench.hpp"
+
+#include <filesystem>
+#include <fstream>
+#include <random>
+
+#include <unistd.h>
+
+#include "response_props.hpp"
+#include "resources.hpp"
+
+namespace fs = std::filesystem;
+
+bench {
+	using namespace mcshub;
+	pakets::handshake hs;
+	hs.address() = "lobby.mc.handtruth.com";
+	hs.port() = 25565;
+	hs.version() = 578;
+	hs.state() = 1;
+	std::unordered_map<std::string, std::string> record_vars = { { "name", "lobby" } };
+	server_vars srv_vars { &record_vars };
+	file_vars f_vars;
+	img_vars i_vars;
+	aggregate_status aggregate;
+	aggregate.online = 42;
+	aggregate.max = 300;
+	aggregate.live = 3;
+	aggregate.total = 3;
+	aggregate.sample = R"([{"name":"player1","id":"00000000-0000-0000-0000-000000000001"}])";
+	agg_vars a_vars { &aggregate };
+	auto vars = make_vars_manager(main_vars, srv_vars, f_vars, i_vars, hs, env_vars, a_vars);
+	const auto & status = res::config::fallback::status_json;
+	const auto & mcsman = res::config::mcsman::status_json;
+	const auto & aggregated = res::config::aggregate::status_json;
+	const auto & login = res::config::fallback::login_json;
+	const auto & mcsman_login = res::config::mcsman::login_json;
+
+	measure("resolve fallback/status.json", {
+		benches::keep(vars.resolve(status));
+	});
+	auto status_tmpl = vars.compile(status);
+	measure("render fallback/status.json", {
+		benches::keep(vars.render(status_tmpl));
+	});
+	measure("resolve mcsman/status.json", {
+		benches::keep(vars.resolve(mcsman));
+	});
+	auto mcsman_tmpl = vars.compile(mcsman);
+	measure("render mcsman/status.json", {
+		benches::keep(vars.render(mcsman_tmpl));
+	});
+	measure("resolve fallback/login.json", {
+		benches::keep(vars.resolve(login));
+	});
+	auto login_tmpl = vars.compile(login);
+	measure("render fallback/login.json", {
+		benches::keep(vars.render(login_tmpl));
+	});
+	measure("resolve mcsman/login.json", {
+		benches::keep(vars.resolve(mcsman_login));
+	});
+	measure("resolve aggregate/status.json", {
+		benches::keep(vars.resolve(aggregated));
+	});
+	auto aggregate_tmpl = vars.compile(aggregated);
+	measure("render aggregate/status.json", {
+		benches::keep(vars.render(aggregate_tmpl));
+	});
+
+	// Server icons are 64x64 PNG files of a few kilobytes
+	fs::path dir = fs::temp_directory_path() / ("mcshub-bench-" + std::to_string(getpid()));
+	fs::create_directory(dir);
+	fs::current_path(dir);
+	{
+		std::ofstream icon("favicon.png", std::ios::binary);
+		std::mt19937 random(42);
+		for (int i = 0; i < 6000; i++)
+			icon.put(char(random()));
+	}
+	measure("img favicon.png (6000 bytes)", {
+		benches::keep(i_vars["favicon.png"]);
+	});
+	fs::current_path(dir.parent_path());
+	fs::remove_all(dir);
+}
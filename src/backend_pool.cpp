@@ -0,0 +1,185 @@
+#include "backend_pool.hpp"
+
+#include <cerrno>
+#include <unordered_set>
+
+#include <sys/socket.h>
+
+#include <ekutils/log.hpp>
+
+#include "logging.hpp"
+
+namespace mcshub {
+
+void backend_pool::connection::on_event(std::uint32_t events) {
+	using namespace ekutils::actions;
+	if (events & (err | hup | rdhup | in)) {
+		// Idle backend should never send anything
+		dead = true;
+	} else if ((events & out) && !established) {
+		established = sock.last_error() == std::errc(0);
+		dead = !established;
+	}
+}
+
+std::size_t backend_pool::backend::established() const noexcept {
+	std::size_t result = 0;
+	for (const connection & c : connections)
+		if (c.established && !c.dead)
+			result++;
+	return result;
+}
+
+std::string backend_pool::key_of(const std::string & host, std::uint16_t port) {
+	return host + ':' + std::to_string(port);
+}
+
+bool backend_pool::alive(connection & c, const options_t & options, clock::time_point now) {
+	if (!c.established || c.dead)
+		return false;
+	if (options.max_age && now - c.created > std::chrono::milliseconds(options.max_age))
+		return false;
+	// The backend may have closed the connection since the last event
+	char byte;
+	ssize_t got = recv(c.sock.get_handle(), &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+	return got == -1 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+void backend_pool::drop(backend & b, std::list<connection>::iterator iter) {
+	poll.remove(iter->sock);
+	b.connections.erase(iter);
+}
+
+bool backend_pool::claim(const std::string & address, std::uint16_t port, const options_t & options,
+		ekutils::tcp_socket_d & result) {
+	auto found = backends.find(key_of(address, port));
+	if (found == backends.end())
+		return false;
+	backend & b = found->second;
+	auto now = clock::now();
+	for (auto iter = b.connections.begin(); iter != b.connections.end();) {
+		auto current = iter++;
+		if (alive(*current, options, now)) {
+			poll.remove(current->sock);
+			result = std::move(current->sock);
+			b.connections.erase(current);
+			return true;
+		}
+		if (current->established || current->dead)
+			drop(b, current);
+	}
+	return false;
+}
+
+void backend_pool::refill(backend & b, const std::string & address, std::uint16_t port,
+		const options_t & options, bool cache, const settings & conf, hosts_db::mailbox & box) {
+	std::size_t count = b.connections.size();
+	if (count >= options.min_idle)
+		return;
+	std::string host = address;
+	if (host.back() == '.')
+		host.pop_back();
+	hosts_db & db = hosts_db::instance();
+	hosts_db::answer_t addresses;
+	auto answer = answers.find(key_of(host, port));
+	if (answer != answers.end()) {
+		addresses = std::move(answer->second);
+		answers.erase(answer);
+	} else if (!cache || !db.find(host, port, addresses)) {
+		// Answer comes to on_resolved() and fills the cache if it is enabled
+		hosts_db::ttl_t ttl { std::chrono::seconds(0), std::chrono::seconds(0) };
+		if (cache)
+			ttl = { std::chrono::seconds(conf.dns_ttl), std::chrono::seconds(conf.dns_negative_ttl) };
+		db.resolve(host, port, ttl, box, slab_handle {});
+		return;
+	}
+	if (!addresses)
+		return;
+	for (; count < options.min_idle; count++) {
+		connection & c = b.connections.emplace_back();
+		try {
+			c.sock.open(*addresses, ekutils::tcp_flags::non_blocking);
+		} catch (const std::exception & e) {
+			lazy_verbose("can't open pooled connection to " + address + ": " + e.what());
+			b.connections.pop_back();
+			return;
+		}
+		c.created = clock::now();
+		connection * ptr = &c;
+		using namespace ekutils::actions;
+		poll.add(c.sock, in | out | err | hup | rdhup | et, [ptr](ekutils::descriptor &, std::uint32_t events) {
+			ptr->on_event(events);
+		});
+	}
+}
+
+void backend_pool::maintain(const settings & conf, hosts_db::mailbox & box) {
+	std::unordered_set<std::string> used;
+	auto now = clock::now();
+	auto visit_backend = [&](const std::string & address, std::uint16_t port, const options_t & options, bool cache) {
+		if (address.empty() || !port)
+			return;
+		std::string key = key_of(address, port);
+		if (!used.insert(key).second)
+			return;
+		backend & b = backends[key];
+		for (auto iter = b.connections.begin(); iter != b.connections.end();) {
+			auto current = iter++;
+			bool expired = options.max_age &&
+				now - current->created > std::chrono::milliseconds(options.max_age);
+			if (current->dead || (current->established && expired))
+				drop(b, current);
+		}
+		for (auto iter = b.connections.begin(); iter != b.connections.end()
+				&& b.established() > options.max_idle;) {
+			auto current = iter++;
+			if (current->established)
+				drop(b, current);
+		}
+		refill(b, address, port, options, cache, conf, box);
+	};
+	auto visit = [&](const settings::basic_record & record) {
+		if (!record.pool.max_idle || record.drop)
+			return;
+		bool cache = conf.dns_cache && !record.mcsman;
+		if (record.upstreams.empty())
+			visit_backend(record.address, record.port, record.pool, cache);
+		for (const auto & upstream : record.upstreams)
+			if (upstream.weight)
+				visit_backend(upstream.address, upstream.port, record.pool, cache);
+	};
+	auto visit_server = [&](const settings::server_record & record) {
+		visit(record);
+		if (record.fml)
+			visit(*record.fml);
+	};
+	visit_server(conf.default_server);
+	for (const auto & [name, record] : conf.servers)
+		visit_server(record);
+	// Backends that are not in the configuration anymore
+	for (auto iter = backends.begin(); iter != backends.end();) {
+		if (used.count(iter->first)) {
+			++iter;
+			continue;
+		}
+		backend & b = iter->second;
+		while (!b.connections.empty())
+			drop(b, b.connections.begin());
+		iter = backends.erase(iter);
+	}
+	// Answers for backends that didn't need them
+	answers.clear();
+}
+
+void backend_pool::on_resolved(const hosts_db::completion & result) {
+	answers[key_of(result.host, result.port)] = result.answer;
+}
+
+std::size_t backend_pool::idle() const noexcept {
+	std::size_t result = 0;
+	for (const auto & [key, b] : backends)
+		result += b.established();
+	return result;
+}
+
+} // namespace mcshub
@@ -0,0 +1,70 @@
+#ifndef _BACKEND_POOL_HEAD
+#define _BACKEND_POOL_HEAD
+
+#include <list>
+#include <chrono>
+#include <string>
+#include <unordered_map>
+
+#include <ekutils/epoll_d.hpp>
+#include <ekutils/socket_d.hpp>
+
+#include "settings.hpp"
+#include "hosts_db.hpp"
+
+namespace mcshub {
+
+// Backend connections of one worker that are established in advance.
+// Records with a pool get idle connections that portals claim instead
+// of waiting for a TCP handshake; the worker refills the pool from time
+// to time with maintain().
+class backend_pool final {
+public:
+	typedef std::chrono::steady_clock clock;
+	typedef settings::basic_record::pool_t options_t;
+private:
+	struct connection {
+		ekutils::tcp_socket_d sock;
+		clock::time_point created;
+		bool established = false;
+		// Set from the epoll handler, connection is removed later
+		bool dead = false;
+		void on_event(std::uint32_t events);
+	};
+	struct backend {
+		std::list<connection> connections;
+		std::size_t established() const noexcept;
+	};
+	ekutils::epoll_d & poll;
+	std::unordered_map<std::string, backend> backends;
+	// Answers that were not cached, taken by the next refill
+	std::unordered_map<std::string, hosts_db::answer_t> answers;
+
+	static std::string key_of(const std::string & host, std::uint16_t port);
+	static bool alive(connection & c, const options_t & options, clock::time_point now);
+	void drop(backend & b, std::list<connection>::iterator iter);
+	void refill(backend & b, const std::string & address, std::uint16_t port, const options_t & options,
+		bool cache, const settings & conf, hosts_db::mailbox & box);
+public:
+	explicit backend_pool(ekutils::epoll_d & p) : poll(p) {}
+	backend_pool(const backend_pool &) = delete;
+	backend_pool & operator=(const backend_pool &) = delete;
+	// Moves an established idle connection to result, false if none
+	bool claim(const std::string & address, std::uint16_t port, const options_t & options,
+		ekutils::tcp_socket_d & result);
+	// Closes dead and old connections and opens new ones. DNS cache is
+	// used as by portals: if dns_cache is set and not for mcsman records.
+	void maintain(const settings & conf, hosts_db::mailbox & box);
+	// Answer to the resolve request of a refill, posted without a client
+	void on_resolved(const hosts_db::completion & result);
+	std::size_t idle() const noexcept;
+	// No record of the last maintained configuration has a pool
+	bool empty() const noexcept {
+		return backends.empty();
+	}
+	static constexpr std::chrono::milliseconds period { 1000 };
+};
+
+} // namespace mcshub
+
+#endif // _BACKEND_POOL_HEAD
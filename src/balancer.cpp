@@ -0,0 +1,174 @@
+#include "balancer.hpp"
+
+#include <algorithm>
+
+namespace mcshub {
+
+balancer::state::state(const std::string & name, const settings::basic_record & record, carried_t & carried) :
+		name(name) {
+	if (record.upstreams.empty())
+		upstreams.push_back({ record.address, record.port, 1 });
+	else
+		upstreams = record.upstreams;
+	for (const auto & upstream : upstreams) {
+		auto found = carried.find(key_of(name, upstream));
+		if (found == carried.end()) {
+			slots.push_back(std::make_shared<counters>());
+		} else {
+			slots.push_back(std::move(found->second));
+			carried.erase(found);
+		}
+	}
+	if (record.balance != settings::balance_t::hash)
+		return;
+	for (std::size_t i = 0, size = upstreams.size(); i < size; i++) {
+		const auto & upstream = upstreams[i];
+		std::string name = key_of(upstream) + '#';
+		for (std::size_t p = 0, points = ring_points * upstream.weight; p < points; p++)
+			ring.emplace_back(hash(name + std::to_string(p)), i);
+	}
+	std::sort(ring.begin(), ring.end());
+}
+
+void balancer::lease::release() noexcept {
+	if (owner)
+		owner->slots[index]->active--;
+	owner.reset();
+}
+
+balancer::lease::lease(const std::shared_ptr<state> & s, std::size_t i) : owner(s), index(i) {
+	owner->slots[index]->active++;
+}
+
+balancer::lease::lease(lease && other) noexcept : owner(std::move(other.owner)), index(other.index) {}
+
+balancer::lease & balancer::lease::operator=(lease && other) noexcept {
+	if (this != &other) {
+		release();
+		owner = std::move(other.owner);
+		index = other.index;
+	}
+	return *this;
+}
+
+bool balancer::usable(const state & s, std::size_t i, const filter_t & filter) {
+	return s.upstreams[i].weight && (!filter || filter(s.upstreams[i]));
+}
+
+std::size_t balancer::round_robin(state & s, const filter_t & filter) {
+	long total = 0;
+	std::size_t best = s.upstreams.size();
+	for (std::size_t i = 0, size = s.upstreams.size(); i < size; i++) {
+		if (!usable(s, i, filter))
+			continue;
+		long weight = s.upstreams[i].weight;
+		s.slots[i]->current += weight;
+		total += weight;
+		if (best == size || s.slots[i]->current > s.slots[best]->current)
+			best = i;
+	}
+	if (best != s.upstreams.size())
+		s.slots[best]->current -= total;
+	return best;
+}
+
+std::size_t balancer::least_conn(state & s, const filter_t & filter) {
+	std::size_t best = s.upstreams.size();
+	for (std::size_t i = 0, size = s.upstreams.size(); i < size; i++) {
+		if (!usable(s, i, filter))
+			continue;
+		// active[i] / weight[i] < active[best] / weight[best]
+		if (best == size || s.slots[i]->active * s.upstreams[best].weight
+				< s.slots[best]->active * s.upstreams[i].weight)
+			best = i;
+	}
+	return best;
+}
+
+std::size_t balancer::by_hash(state & s, std::string_view key, const filter_t & filter) {
+	std::uint32_t point = hash(key);
+	auto iter = std::lower_bound(s.ring.begin(), s.ring.end(), std::make_pair(point, std::size_t(0)));
+	// Next points of the ring take players of unusable upstreams
+	for (std::size_t i = 0, size = s.ring.size(); i < size; i++, ++iter) {
+		if (iter == s.ring.end())
+			iter = s.ring.begin();
+		if (usable(s, iter->second, filter))
+			return iter->second;
+	}
+	return s.upstreams.size();
+}
+
+balancer::lease balancer::pick(const std::string & name, const settings::basic_record & record, unsigned long gen,
+		std::string_view key, const filter_t & filter) {
+	if (gen > generation) {
+		carry_over();
+		generation = gen;
+	}
+	auto & s = states[&record];
+	if (!s)
+		s = std::make_shared<state>(name, record, carried);
+	std::size_t index;
+	switch (record.balance) {
+		case settings::balance_t::least_conn:
+			index = least_conn(*s, filter);
+			break;
+		case settings::balance_t::hash:
+			if (!key.empty() && !s->ring.empty()) {
+				index = by_hash(*s, key, filter);
+				break;
+			}
+			[[fallthrough]];
+		default:
+			index = round_robin(*s, filter);
+			break;
+	}
+	if (index == s->upstreams.size())
+		return lease();
+	return lease(s, index);
+}
+
+std::string balancer::key_of(const settings::upstream_t & upstream) {
+	return upstream.address + ':' + std::to_string(upstream.port);
+}
+
+std::string balancer::key_of(const std::string & name, const settings::upstream_t & upstream) {
+	return name + '\n' + key_of(upstream);
+}
+
+void balancer::carry_over() {
+	// Counters nobody took are only worth keeping while they have leases
+	for (auto iter = carried.begin(); iter != carried.end();) {
+		if (iter->second->active)
+			++iter;
+		else
+			iter = carried.erase(iter);
+	}
+	// Leases of old records keep their own state and share the counters
+	for (const auto & [record, s] : states)
+		for (std::size_t i = 0, size = s->upstreams.size(); i < size; i++)
+			carried.emplace(key_of(s->name, s->upstreams[i]), s->slots[i]);
+	states.clear();
+}
+
+std::uint32_t balancer::hash(std::string_view key) noexcept {
+	// FNV-1a, stable between runs and threads
+	std::uint32_t result = 2166136261u;
+	for (char c : key) {
+		result ^= std::uint8_t(c);
+		result *= 16777619u;
+	}
+	// Final mix, ring points differ only in the last characters
+	result ^= result >> 16;
+	result *= 0x85ebca6bu;
+	result ^= result >> 13;
+	result *= 0xc2b2ae35u;
+	result ^= result >> 16;
+	return result;
+}
+
+balancer & balancer::local() {
+	thread_local balancer instance;
+	return instance;
+}
+
+} // namespace mcshub
@@ -0,0 +1,88 @@
+#ifndef _BALANCER_HEAD
+#define _BALANCER_HEAD
+
+#include <memory>
+#include <functional>
+#include <string>
+#include <vector>
+#include <string_view>
+#include <unordered_map>
+
+#include "settings.hpp"
+
+namespace mcshub {
+
+// Per thread choice of backends for records with several upstreams.
+// Counters are kept by every worker independently. A new configuration
+// generation carries them over to the same upstreams of the record with
+// the same name.
+class balancer final {
+public:
+	struct counters {
+		// Smooth weighted round robin
+		long current = 0;
+		// Connections of this worker
+		std::size_t active = 0;
+	};
+	typedef std::unordered_map<std::string, std::shared_ptr<counters>> carried_t;
+	struct state {
+		// Record name, counters are carried over by it
+		std::string name;
+		std::vector<settings::upstream_t> upstreams;
+		std::vector<std::shared_ptr<counters>> slots;
+		// Consistent hash ring: point hash and upstream index
+		std::vector<std::pair<std::uint32_t, std::size_t>> ring;
+		// Takes counters of the same upstreams out of carried
+		state(const std::string & name, const settings::basic_record & record, carried_t & carried);
+	};
+
+	// Chosen upstream, counted as an active connection while it lives
+	class lease final {
+		std::shared_ptr<state> owner;
+		std::size_t index = 0;
+		void release() noexcept;
+	public:
+		lease() noexcept {}
+		lease(const std::shared_ptr<state> & s, std::size_t i);
+		lease(const lease &) = delete;
+		lease & operator=(const lease &) = delete;
+		lease(lease && other) noexcept;
+		lease & operator=(lease && other) noexcept;
+		~lease() {
+			release();
+		}
+		explicit operator bool() const noexcept {
+			return owner != nullptr;
+		}
+		const settings::upstream_t & upstream() const noexcept {
+			return owner->upstreams[index];
+		}
+	};
+
+	static constexpr std::size_t ring_points = 64;
+	typedef std::function<bool(const settings::upstream_t &)> filter_t;
+private:
+	unsigned long generation = 0;
+	std::unordered_map<const settings::basic_record *, std::shared_ptr<state>> states;
+	// Counters of the previous generation that no record took yet
+	carried_t carried;
+	static std::string key_of(const settings::upstream_t & upstream);
+	static std::string key_of(const std::string & name, const settings::upstream_t & upstream);
+	void carry_over();
+	static bool usable(const state & s, std::size_t i, const filter_t & filter);
+	static std::size_t round_robin(state & s, const filter_t & filter);
+	static std::size_t least_conn(state & s, const filter_t & filter);
+	static std::size_t by_hash(state & s, std::string_view key, const filter_t & filter);
+public:
+	// Empty key makes hash policy fall back to round robin. Upstreams
+	// rejected by the filter are skipped, empty lease if none is left.
+	// Older generations keep the counters of the newest one.
+	lease pick(const std::string & name, const settings::basic_record & record, unsigned long gen,
+		std::string_view key = {}, const filter_t & filter = nullptr);
+	static std::uint32_t hash(std::string_view key) noexcept;
+	static balancer & local();
+};
+
+} // namespace mcshub
+
+#endif // _BALANCER_HEAD
@@ -0,0 +1,135 @@
+#include "buffer_pool.hpp"
+
+#include <cstring>
+
+namespace mcshub {
+
+buffer_pool::~buffer_pool() {
+	{
+		std::lock_guard lock(self->mutex);
+		self->gone = true;
+		for (auto [slab, capacity] : self->returned)
+			delete[] slab;
+		self->returned.clear();
+	}
+	for (auto & slabs : free)
+		for (byte_t * slab : slabs)
+			delete[] slab;
+}
+
+void buffer_pool::collect() noexcept {
+	std::vector<std::pair<byte_t *, std::size_t>> returned;
+	{
+		std::lock_guard lock(self->mutex);
+		returned.swap(self->returned);
+		self->pending.store(false, std::memory_order_relaxed);
+	}
+	for (auto [slab, capacity] : returned)
+		give(slab, capacity);
+}
+
+byte_t * buffer_pool::take(std::size_t & capacity) {
+	if (self->pending.load(std::memory_order_relaxed))
+		collect();
+	for (std::size_t i = 0; i < classes.size(); i++) {
+		if (capacity <= classes[i]) {
+			capacity = classes[i];
+			auto & slabs = free[i];
+			if (!slabs.empty()) {
+				byte_t * slab = slabs.back();
+				slabs.pop_back();
+				return slab;
+			}
+			allocs++;
+			return new byte_t[capacity];
+		}
+	}
+	allocs++;
+	return new byte_t[capacity];
+}
+
+void buffer_pool::give(byte_t * slab, std::size_t capacity) noexcept {
+	for (std::size_t i = 0; i < classes.size(); i++) {
+		if (capacity == classes[i]) {
+			auto & slabs = free[i];
+			if (slabs.size() < max_free[i]) {
+				try {
+					slabs.push_back(slab);
+					return;
+				} catch (...) {}
+			}
+			break;
+		}
+	}
+	delete[] slab;
+}
+
+void buffer_pool::give_back(const owner_t & owner, byte_t * slab, std::size_t capacity) noexcept {
+	buffer_pool & pool = local();
+	if (!owner || owner == pool.self)
+		return pool.give(slab, capacity);
+	std::lock_guard lock(owner->mutex);
+	if (!owner->gone) {
+		try {
+			owner->returned.emplace_back(slab, capacity);
+			owner->pending.store(true, std::memory_order_relaxed);
+			return;
+		} catch (...) {}
+	}
+	delete[] slab;
+}
+
+std::size_t buffer_pool::cached() const noexcept {
+	std::size_t result = 0;
+	for (auto & slabs : free)
+		result += slabs.size();
+	return result;
+}
+
+buffer_pool & buffer_pool::local() {
+	thread_local buffer_pool pool;
+	return pool;
+}
+
+void io_buffer::reserve(std::size_t length) {
+	if (length == 0 || (slab && tail + length <= capacity))
+		return;
+	std::size_t count = size();
+	std::size_t required = count + length;
+	if (slab && required <= capacity) {
+		// Enough space, but it is fragmented
+		std::memmove(slab, slab + head, count);
+	} else {
+		std::size_t new_capacity = required;
+		if (slab && new_capacity < capacity * 2)
+			new_capacity = capacity * 2;
+		buffer_pool & pool = buffer_pool::local();
+		byte_t * new_slab = pool.take(new_capacity);
+		if (slab) {
+			std::memcpy(new_slab, slab + head, count);
+			buffer_pool::give_back(owner, slab, capacity);
+		}
+		owner = pool.owner();
+		slab = new_slab;
+		capacity = new_capacity;
+	}
+	head = 0;
+	tail = count;
+}
+
+void io_buffer::release() noexcept {
+	if (slab)
+		buffer_pool::give_back(owner, slab, capacity);
+	owner.reset();
+	slab = nullptr;
+	capacity = head = tail = 0;
+}
+
+void io_buffer::append(const byte_t * bytes, std::size_t length) {
+	if (length == 0)
+		return;
+	asize(length);
+	std::memcpy(slab + tail - length, bytes, length);
+}
+
+} // namespace mcshub
@@ -0,0 +1,111 @@
+#ifndef _BUFFER_POOL_HEAD
+#define _BUFFER_POOL_HEAD
+
+#include <array>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <cstddef>
+
+#include <ekutils/primitives.hpp>
+
+namespace mcshub {
+
+using ekutils::byte_t;
+
+// Per thread cache of I/O slabs of several fixed size classes. Slabs that
+// are bigger than the largest class are allocated and freed directly.
+// A slab released by another thread goes back to the pool it came from.
+class buffer_pool final {
+public:
+	static constexpr std::array<std::size_t, 3> classes = { 4096, 16384, 65536 };
+	static constexpr std::array<std::size_t, 3> max_free = { 256, 64, 16 };
+	// Slabs given back by other threads, moved to the pool on take()
+	struct home {
+		std::mutex mutex;
+		std::vector<std::pair<byte_t *, std::size_t>> returned;
+		std::atomic<bool> pending { false };
+		// Pool is destroyed, returned slabs are freed right away
+		bool gone = false;
+	};
+	typedef std::shared_ptr<home> owner_t;
+private:
+	std::array<std::vector<byte_t *>, classes.size()> free;
+	std::size_t allocs = 0;
+	owner_t self = std::make_shared<home>();
+	void collect() noexcept;
+public:
+	buffer_pool() = default;
+	buffer_pool(const buffer_pool &) = delete;
+	buffer_pool & operator=(const buffer_pool &) = delete;
+	~buffer_pool();
+	// capacity is rounded up to the slab size
+	byte_t * take(std::size_t & capacity);
+	void give(byte_t * slab, std::size_t capacity) noexcept;
+	const owner_t & owner() const noexcept {
+		return self;
+	}
+	// Returns the slab to its owner from any thread
+	static void give_back(const owner_t & owner, byte_t * slab, std::size_t capacity) noexcept;
+	std::size_t allocations() const noexcept {
+		return allocs;
+	}
+	std::size_t cached() const noexcept;
+	static buffer_pool & local();
+};
+
+// Byte queue that borrows its storage from the thread local buffer_pool
+// and returns it as soon as it is drained.
+class io_buffer final {
+	byte_t * slab = nullptr;
+	// Pool of the thread that took the slab
+	buffer_pool::owner_t owner;
+	std::size_t capacity = 0, head = 0, tail = 0;
+	void reserve(std::size_t length);
+	void release() noexcept;
+public:
+	io_buffer() noexcept {}
+	io_buffer(const io_buffer &) = delete;
+	io_buffer & operator=(const io_buffer &) = delete;
+	~io_buffer() {
+		release();
+	}
+	byte_t * data() noexcept {
+		return slab + head;
+	}
+	const byte_t * data() const noexcept {
+		return slab + head;
+	}
+	std::size_t size() const noexcept {
+		return tail - head;
+	}
+	bool holds_memory() const noexcept {
+		return slab != nullptr;
+	}
+	// Add length uninitialized bytes to the end
+	void asize(std::size_t length) {
+		reserve(length);
+		tail += length;
+	}
+	// Remove length bytes from the end
+	void ssize(std::size_t length) noexcept {
+		tail -= length;
+		if (tail == head)
+			release();
+	}
+	// Remove length bytes from the beginning
+	void move(std::size_t length) noexcept {
+		head += length;
+		if (tail == head)
+			release();
+	}
+	void clear() noexcept {
+		release();
+	}
+	void append(const byte_t * bytes, std::size_t length);
+};
+
+} // namespace mcshub
+
+#endif // _BUFFER_POOL_HEAD
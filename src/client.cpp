@@ -1,14 +1,19 @@
 #include "client.hpp"
 
-#include <cstring>
 #include <cassert>
+#include <cerrno>
 #include <stdexcept>
 #include <system_error>
 
+#include <sys/socket.h>
+
 #include <ekutils/log.hpp>
 
 #include "hosts_db.hpp"
+#include "health.hpp"
+#include "record_route.hpp"
 #include "resources.hpp"
+#include "logging.hpp"
 
 namespace mcshub {
 
@@ -43,14 +48,18 @@ bool gate::head(std::int32_t & id, std::int32_t & size) const {
 		return false;
 	if (size < 0)
 		throw bad_request("packet size is lower than 0");
-	conf_snap conf;
-	std::int32_t max_size = conf->max_packet_size;
+	std::int32_t max_size = conf_reader::get().max_packet_size;
 	if (max_size != -1 && size > max_size)
 		throw bad_request("the maximum allowed packet size was reached");
 	size += s;
 	return std::size_t(size) <= input.size();
 }
 
+void gate::write(const byte_t * data, std::size_t size) {
+	output.append(data, size);
+	send();
+}
+
 void gate::kostilA() {
 	pakets::request req;
 	std::size_t sz = req.size() + 10;
@@ -71,31 +80,166 @@ void gate::kostilB(const std::string & nick) {
 }
 
 void gate::tunnel(gate & other) {
+	account(input.size());
 	other.output.append(input.data(), input.size());
 	input.clear();
 	other.send();
 }
 
+bool gate::splice(gate & other) {
+	if (!pipe.is_open() && !pipe.open()) {
+		zero_copy = false;
+		splice_broken = true;
+		return false;
+	}
+	// Bytes that were received before the tunnel became stable go first
+	if (input.size() != 0)
+		tunnel(other);
+	if (other.output.size() != 0)
+		return true;
+	int in = sock.get_handle(), out = other.sock.get_handle();
+	while (true) {
+		if (pipe.drain(out) == splice_pipe::result::again)
+			return true;
+		std::size_t before = pipe.avail();
+		splice_pipe::result filled = pipe.fill(in);
+		account(pipe.avail() - before);
+		spliced_bytes.fetch_add(pipe.avail() - before, std::memory_order_relaxed);
+		switch (filled) {
+			case splice_pipe::result::done:
+				break;
+			case splice_pipe::result::again:
+				pipe.drain(out);
+				return true;
+			case splice_pipe::result::unsupported:
+				lazy_verbose("splice is not supported for socket " + std::string(sock.remote_endpoint()));
+				pipe.close();
+				zero_copy = false;
+				splice_broken = true;
+				return false;
+		}
+	}
+}
+
+std::atomic<unsigned long> gate::throttled_gates = 0;
+std::atomic<unsigned long> gate::throttle_events = 0;
+
+void gate::throttle(bool value) noexcept {
+	if (throttled == value)
+		return;
+	throttled = value;
+	if (value) {
+		throttled_gates++;
+		throttle_events++;
+	} else {
+		throttled_gates--;
+	}
+}
+
+void gate::account(std::size_t bytes) noexcept {
+	metrics::local().add(traffic, bytes);
+	if (record) {
+		bool upstream = traffic == metrics::counter_t::bytes_upstream;
+		record->add(upstream ? record_stats::counter_t::bytes_in : record_stats::counter_t::bytes_out, bytes);
+	}
+}
+
+void gate::forward(gate & other, std::size_t high, std::size_t low) {
+	if (input.size() != 0) {
+		account(input.size());
+		other.output.append(input.data(), input.size());
+		input.clear();
+	}
+	while (true) {
+		if (high) {
+			// Leave data in the socket until the peer drains its output,
+			// TCP flow control will slow down the sender.
+			std::size_t pending = other.output.size();
+			if (throttled && pending > low)
+				return;
+			if (pending >= high) {
+				if (!throttled)
+					lazy_debug("tunnel throttled for " + std::string(sock.remote_endpoint()));
+				throttle(true);
+				return;
+			}
+		}
+		throttle(false);
+		// Read straight into the buffer that will be written to the other
+		// socket, but not more than the high watermark allows
+		bool drained;
+		account(read_to(other.output, high, drained));
+		other.send();
+		if (drained)
+			return;
+	}
+}
+
+std::atomic<unsigned long long> gate::receive_events = 0;
+std::atomic<unsigned long long> gate::read_calls = 0;
+std::atomic<unsigned long long> gate::spliced_bytes = 0;
+
+std::size_t gate::read_to(io_buffer & buff, std::size_t limit, bool & drained) {
+	// Socket is edge triggered, so read until a short read shows that
+	// it was drained. Chunk grows while reads fill it completely and
+	// shrinks when an event brings less than a half of it.
+	std::size_t total = 0;
+	unsigned long long reads = 0;
+	drained = false;
+	while (!limit || buff.size() < limit) {
+		std::size_t want = read_chunk;
+		if (limit && limit - buff.size() < want)
+			want = limit - buff.size();
+		std::size_t old = buff.size();
+		buff.asize(want);
+		int got = sock.read(buff.data() + old, want);
+		reads++;
+		std::size_t received = got < 0 ? 0 : std::size_t(got);
+		buff.ssize(want - received);
+		total += received;
+		if (received < want) {
+			drained = true;
+			break;
+		}
+		if (want == read_chunk && read_chunk < max_read_chunk)
+			read_chunk *= 2;
+	}
+	if (drained && total < read_chunk / 2 && read_chunk > min_read_chunk)
+		read_chunk /= 2;
+	if (reads) {
+		// Every counted event made at least one read
+		read_calls.fetch_add(reads, std::memory_order_relaxed);
+		receive_events.fetch_add(1, std::memory_order_relaxed);
+	}
+	return total;
+}
+
 void gate::receive() {
-	std::size_t avail = sock.avail();
-	std::size_t old = input.size();
-	input.asize(avail);
-	sock.read(input.data() + old, avail);
+	bool drained;
+	read_to(input, 0, drained);
 }
 
 void gate::send() {
-	if (output.size() == 0)
+	// Don't try write(2) until the next EPOLLOUT if it would block anyway
+	if (output.size() == 0 || !writable)
 		return;
 	int written = sock.write(output.data(), output.size());
-	if (written == -1)
+	if (written == -1) {
+		writable = false;
 		return;
+	}
 	output.move(written);
+	if (output.size() != 0)
+		writable = false;
 }
 
 std::atomic<long> portal::globl_id = 0;
+std::atomic<unsigned long> portal::handshake_states = 0;
 
 void portal::set_from_state_by_hs() {
-	switch (hs.state()) {
+	// Backend is not used by the fake response
+	backend = balancer::lease();
+	switch (ctx->hs.state()) {
 	case 1:
 		from_s = state_t::status_fake;
 		return;
@@ -103,76 +247,129 @@ void portal::set_from_state_by_hs() {
 		from_s = state_t::login_fake;
 		return;
 	default:
-		throw bad_request("handshake has a bad state: " + std::to_string(hs.state()));
+		throw bad_request("handshake has a bad state: " + std::to_string(ctx->hs.state()));
 	}
 }
 
 const settings::basic_record & portal::record(const conf_snap & conf) {
-	const auto & servers = conf->servers;
-	server_name = hs.address().c_str();
-	std::string & name = server_name;
-	std::size_t name_sz = name.size();
-	const std::string & domain = conf->domain;
-	std::size_t domain_sz = domain.size();
-	bool is_fml = name.size() != hs.address().size();
-	if (name[name_sz - 1] == '.')
-		name.pop_back();
-	if (name_sz > domain_sz && !std::strcmp(name.c_str() + name_sz - domain_sz, domain.c_str())) {
-		name.resize(name_sz - domain_sz);
-	}
-	f_vars.srv_name = server_name;
-	i_vars.srv_name = server_name;
-	const auto & iter = servers.find(name);
-	if (iter != servers.end()) {
-		const settings::server_record & r = iter->second;
-		if (is_fml && r.fml)
-			return *r.fml;
-		return r;
-	}
-	const settings::server_record & r = conf->default_server;
-	if (is_fml && r.fml)
-		return *r.fml;
-	return r;
+	auto route = route_record(*conf->routes, conf->default_server, ctx->hs.address(), ctx->server_name);
+	ctx->f_vars.srv_name = ctx->server_name;
+	ctx->i_vars.srv_name = ctx->server_name;
+	stats = &route.stats;
+	from.record = to.record = stats;
+	ctx->record_name = health_checker::record_name(route.stats_name, route.fml);
+	return route.record;
 }
 
-std::string portal::resolve_status() {
-	const auto & record = rec.get();
-	srv_vars.vars = &record.vars;
+std::string portal::load_status() {
+	const auto & record = ctx->rec.get();
 	std::ifstream file(record.status);
-	log_debug("open status file: " + record.status);
+	lazy_debug("open status file: " + record.status);
 	if (!file) {
 		if (!record.status.empty())
-			log_warning("status file '" + record.status + "' not accessible");
-		if (record.mcsman)
-			return vars.resolve(res::config::mcsman::status_json);
+			lazy_warning("status file '" + record.status + "' not accessible");
+		if (record.aggregate)
+			return std::string(reinterpret_cast<const char *>(res::config::aggregate::status_json.data()), res::config::aggregate::status_json.size());
+		else if (record.mcsman)
+			return std::string(reinterpret_cast<const char *>(res::config::mcsman::status_json.data()), res::config::mcsman::status_json.size());
 		else
-			return vars.resolve(res::config::fallback::status_json);
+			return std::string(reinterpret_cast<const char *>(res::config::fallback::status_json.data()), res::config::fallback::status_json.size());
 	}
-	std::string content = std::string((std::istreambuf_iterator<char>(file)), (std::istreambuf_iterator<char>()));
-	return vars.resolve(content);
+	return std::string((std::istreambuf_iterator<char>(file)), (std::istreambuf_iterator<char>()));
 }
 
-std::string portal::resolve_login() {
-	const auto & record = rec.get();
-	srv_vars.vars = &record.vars;
+namespace {
+
+// Template of the file is the same until the configuration is republished
+bool stable(const std::string & file) {
+	return file.empty() || watched_file(file);
+}
+
+} // namespace
+
+const compiled_template & portal::compiled(status_cache::template_t kind) {
+	const auto & record = ctx->rec.get();
+	status_cache & cache = status_cache::local();
+	if (const compiled_template * tmpl = cache.find_template(conf->generation, kind, &record))
+		return *tmpl;
+	std::string content = kind == status_cache::template_t::status ? load_status() : load_login();
+	return cache.store_template(conf->generation, kind, &record, hub_vars::compile(content));
+}
+
+std::string portal::resolve_status() {
+	const auto & record = ctx->rec.get();
+	ctx->srv_vars.vars = &record.vars;
+	if (stable(record.status))
+		return ctx->vars.render(compiled(status_cache::template_t::status));
+	return ctx->vars.resolve(load_status());
+}
+
+void portal::send_status() {
+	const auto & record = ctx->rec.get();
+	status_cache & cache = status_cache::local();
+	if (!cache.usable(conf->generation) || !stable(record.status)) {
+		// Outdated configuration or a file whose changes are not watched,
+		// frames are not kept
+		pakets::response response;
+		response.message() = resolve_status();
+		from.paket_write(response);
+		return;
+	}
+	status_cache::entry * entry = cache.find(&record);
+	if (!entry) {
+		compiled_template tmpl = hub_vars::compile(load_status());
+		// Files read by variables are not watched
+		bool volatile_vars = tmpl.uses(hub_vars::ns_index<main_vars_t>(), "uuid") ||
+			tmpl.uses(hub_vars::ns_index<file_vars>()) || tmpl.uses(hub_vars::ns_index<img_vars>());
+		bool uses_hs = tmpl.uses(hub_vars::ns_index<pakets::handshake>());
+		bool uses_agg = tmpl.uses(hub_vars::ns_index<agg_vars>());
+		entry = &cache.insert(&record, std::move(tmpl), volatile_vars, uses_hs, uses_agg);
+	}
+	ctx->srv_vars.vars = &record.vars;
+	if (entry->volatile_vars) {
+		pakets::response response;
+		response.message() = ctx->vars.render(entry->tmpl);
+		from.paket_write(response);
+		return;
+	}
+	std::string key = status_cache::frame_key(*entry, ctx->hs);
+	if (entry->uses_agg)
+		cache.renew(*entry, ctx->aggregate ? ctx->aggregate->revision : 0);
+	const status_cache::frame_t * frame = cache.find_frame(*entry, key);
+	if (!frame)
+		frame = &cache.store(*entry, key, ctx->vars.render(entry->tmpl));
+	from.write(frame->data(), frame->size());
+}
+
+std::string portal::load_login() {
+	const auto & record = ctx->rec.get();
 	std::ifstream file(record.login);
-	log_debug("open login file: " + record.login);
+	lazy_debug("open login file: " + record.login);
 	if (!file) {
 		if (!record.status.empty())
-			log_warning("login file '" + record.login + "' not accessible");
+			lazy_warning("login file '" + record.login + "' not accessible");
 		if (record.mcsman)
-			return vars.resolve(res::config::mcsman::login_json);
+			return std::string(reinterpret_cast<const char *>(res::config::mcsman::login_json.data()), res::config::mcsman::login_json.size());
 		else
-			return vars.resolve(res::config::fallback::login_json);
+			return std::string(reinterpret_cast<const char *>(res::config::fallback::login_json.data()), res::config::fallback::login_json.size());
 	}
-	std::string content = std::string((std::istreambuf_iterator<char>(file)), (std::istreambuf_iterator<char>()));
-	return vars.resolve(content);
+	return std::string((std::istreambuf_iterator<char>(file)), (std::istreambuf_iterator<char>()));
+}
+
+std::string portal::resolve_login() {
+	const auto & record = ctx->rec.get();
+	ctx->srv_vars.vars = &record.vars;
+	if (stable(record.login))
+		return ctx->vars.render(compiled(status_cache::template_t::login));
+	return ctx->vars.resolve(load_login());
 }
 
 void portal::process_from_request() {
 	switch (from_s) {
 		case state_t::handshake:
 			return from_handshake();
+		case state_t::pick:
+			return from_pick();
 		case state_t::wait:
 			return;
 		case state_t::login:
@@ -190,44 +387,135 @@ void portal::process_from_request() {
 }
 
 void portal::from_handshake() {
-	if (!from.paket_read(hs))
+	if (!from.paket_read(ctx->hs))
 		return;
-	log_debug("client #" + std::to_string(id) + " send handshake: " + std::to_string(hs));
+	lazy_debug("client #" + std::to_string(id) + " send handshake: " + std::to_string(ctx->hs));
+	ctx->started = std::chrono::steady_clock::now();
+	bool status = ctx->hs.state() == 1;
+	metrics::local().add(status ? metrics::counter_t::status_handshakes : metrics::counter_t::login_handshakes);
 	const auto & r = record(conf);
+	stats->add(status ? record_stats::counter_t::status_requests : record_stats::counter_t::login_attempts);
 	if (r.drop)
 		throw bad_request("drop");
-	rec = r;
-	if (!r.address.empty() && r.port) {
-		try {
-			connect(to.sock, conf->dns_cache && !r.mcsman, r.address, r.port);
-			to_s = state_t::connect;
-			from_s = state_t::wait;
-			log_verbose("attempt to connect to " + r.address + ":" + std::to_string(r.port));
-			using namespace ekutils::actions;
-			poll.add(to.sock, in | out | rdhup | err | et, [this](auto &, std::uint32_t events) {
-				on_to_event(events);
-			});
-			timeout = poll.later(std::chrono::milliseconds { conf->timeout }, [this]() {
-				on_timeout();
-			});
-			return;
-		} catch (const ekutils::dns_error &) {
-
+	ctx->rec = r;
+	if (r.aggregate && ctx->hs.state() == 1) {
+		// Computed by the health checker, backends are not asked here
+		ctx->aggregate = health_checker::instance().aggregate(ctx->record_name, conf->generation);
+		ctx->a_vars.status = ctx->aggregate.get();
+		set_from_state_by_hs();
+		return process_from_request();
+	}
+	if (r.has_backend()) {
+		if (r.balance == settings::balance_t::hash && r.upstreams.size() > 1 && ctx->hs.state() == 2) {
+			// Upstream depends on the nickname from the login packet
+			from_s = state_t::pick;
+			return process_from_request();
 		}
+		return connect_upstream();
 	}
 	set_from_state_by_hs();
 	process_from_request(); // Вообще это костыль
 }
 
+void portal::from_pick() {
+	pakets::login login;
+	if (!from.paket_read(login))
+		return;
+	ctx->nickname = std::move(login.name());
+	// Login packet is forwarded after the handshake as usual
+	from.kostilB(ctx->nickname);
+	connect_upstream(ctx->nickname);
+}
+
+void portal::connect_upstream(std::string_view key) {
+	const auto & r = ctx->rec.get();
+	health_checker & health = health_checker::instance();
+	balancer::filter_t live;
+	if (conf->health_interval) {
+		live = [&health](const settings::upstream_t & upstream) {
+			return !health.is_down(upstream.address, upstream.port);
+		};
+	}
+	backend = balancer::local().pick(ctx->record_name, r, conf->generation, key, live);
+	if (!backend) {
+		// Every backend is down, don't make the player wait for timeout
+		lazy_verbose("no live backend for client #" + std::to_string(id));
+		set_from_state_by_hs();
+		process_from_request();
+		return;
+	}
+	const auto & upstream = backend.upstream();
+	if (r.status_ttl && ctx->hs.state() == 1) {
+		// Refreshed by the health checker every status_ttl
+		std::chrono::milliseconds max_age(2 * r.status_ttl);
+		if ((ctx->live_status = health.live_status(upstream.address, upstream.port, max_age))) {
+			backend = balancer::lease();
+			set_from_state_by_hs();
+			process_from_request();
+			return;
+		}
+	}
+	if (r.pool.max_idle && backends.claim(upstream.address, upstream.port, r.pool, to.sock)) {
+		lazy_verbose("client #" + std::to_string(id) + " takes pooled connection to " + upstream.address);
+		return watch_backend();
+	}
+	std::string host = upstream.address;
+	if (host.back() == '.')
+		host.pop_back();
+	bool cache = conf->dns_cache && !r.mcsman;
+	hosts_db & db = hosts_db::instance();
+	hosts_db::answer_t addresses;
+	if (cache && db.find(host, upstream.port, addresses))
+		return connect_backend(addresses);
+	// Park the connection until the resolver thread answers
+	to_s = state_t::resolve;
+	from_s = state_t::wait;
+	hosts_db::ttl_t ttl { std::chrono::seconds(0), std::chrono::seconds(0) };
+	if (cache)
+		ttl = { std::chrono::seconds(conf->dns_ttl), std::chrono::seconds(conf->dns_negative_ttl) };
+	db.resolve(host, upstream.port, ttl, mailbox, self);
+}
+
+void portal::connect_backend(const hosts_db::answer_t & addresses) {
+	const auto & upstream = backend.upstream();
+	if (!addresses) {
+		lazy_verbose("backend address " + upstream.address + " can't be resolved");
+		metrics::local().add(metrics::counter_t::connect_failures);
+		to_s = state_t::wait;
+		set_from_state_by_hs();
+		arm_deadline(conf->handshake_timeout);
+		process_from_request();
+		return;
+	}
+	to.sock.open(*addresses, ekutils::tcp_flags::non_blocking);
+	lazy_verbose("attempt to connect to " + upstream.address + ":" + std::to_string(upstream.port));
+	watch_backend();
+}
+
+void portal::watch_backend() {
+	// Pooled connections are already established, the first out event
+	// is handled the same way as a completed connect
+	to_s = state_t::connect;
+	from_s = state_t::wait;
+	using namespace ekutils::actions;
+	poll.add(to.sock, in | out | rdhup | err | et, [this](auto &, std::uint32_t events) {
+		on_to_event(events);
+	});
+	timers.arm(deadline, std::chrono::milliseconds(conf->timeout));
+}
+
 void portal::from_login() {
 	pakets::login login;
 	if (!from.paket_read(login))
 		return;
-	log_info("player \"" + login.name() + "\" connected to server \"" +
-		hs.address() + "\" with connection id #" + std::to_string(id));
+	lazy_info("player \"" + login.name() + "\" connected to server \"" +
+		ctx->hs.address() + "\" with connection id #" + std::to_string(id));
 	from_s = state_t::proxy;
 	to.paket_write(login);
-	nickname = std::move(login.name());
+	ctx->nickname = std::move(login.name());
+	// Bytes received together with the login follow it right away
+	if (from.avail_read())
+		from_proxy();
 }
 
 void portal::from_fake_status() {
@@ -239,17 +527,22 @@ void portal::from_fake_status() {
 			pakets::request req;
 			if (!from.paket_read(req))
 				return;
-			log_verbose("status request from connection #" + std::to_string(id));
-			pakets::response response;
-			response.message() = resolve_status();
-			from.paket_write(response);
+			lazy_verbose("status request from connection #" + std::to_string(id));
+			metrics::shard & stats = metrics::local();
+			if (ctx->live_status) {
+				stats.add(metrics::counter_t::status_cached);
+				from.write(ctx->live_status->data(), ctx->live_status->size());
+			} else {
+				stats.add(ctx->aggregate ? metrics::counter_t::status_aggregate : metrics::counter_t::status_fake);
+				send_status();
+			}
 			break;
 		}
 		case pakets::ids::pingpong: {
 			pakets::pinpong ping_pong;
 			if (!from.paket_read(ping_pong))
 				return;
-			log_verbose("ping request from connection #" + std::to_string(id));
+			lazy_verbose("ping request from connection #" + std::to_string(id));
 			from.paket_write(ping_pong);
 			break;
 		}
@@ -262,8 +555,10 @@ void portal::from_fake_login() {
 	pakets::login login;
 	if (!from.paket_read(login))
 		return;
-	log_info("player \"" + login.name() + "\" tried to connect to server \"" +
-		hs.address() + "\" with connection id #" + std::to_string(id));
+	lazy_info("player \"" + login.name() + "\" tried to connect to server \"" +
+		ctx->hs.address() + "\" with connection id #" + std::to_string(id));
+	metrics::local().add(metrics::counter_t::logins_fake);
+	stats->add(record_stats::counter_t::fake_logins);
 	pakets::disconnect dc;
 	dc.message() = resolve_login();
 	from.paket_write(dc);
@@ -271,7 +566,9 @@ void portal::from_fake_login() {
 }
 
 void portal::from_proxy() {
-	from.tunnel(to);
+	if (from.spliced() && from.splice(to))
+		return;
+	from.forward(to, conf->high_watermark, conf->low_watermark);
 }
 
 void portal::process_to_request() {
@@ -287,25 +584,64 @@ void portal::process_to_request() {
 }
 
 void portal::to_send_new_hs() {
-	pakets::handshake new_hs = hs;
+	pakets::handshake new_hs = ctx->hs;
 	to.paket_write(new_hs);
-	assert(poll.refuse(timeout));
+	auto latency = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - ctx->started);
+	metrics::shard & global = metrics::local();
+	global.add(ctx->hs.state() == 1 ? metrics::counter_t::status_proxied : metrics::counter_t::logins_proxied);
+	global.observe(metrics::histogram_t::backend_latency, latency);
+	stats->add(record_stats::counter_t::tunnels_opened);
+	stats->observe(latency);
+	tunneled = true;
+	active = false;
+	arm_deadline(conf->idle_timeout);
 	to_s = state_t::proxy;
-	from_s = (hs.state() == 1) ? state_t::proxy : state_t::login;
+	from_s = (ctx->hs.state() == 1) ? state_t::proxy : state_t::login;
 	process_to_request();
 	process_from_request();
 }
 
 void portal::to_proxy() {
-	to.tunnel(from);
+	if (to.spliced() && to.splice(from))
+		return;
+	to.forward(from, conf->high_watermark, conf->low_watermark);
+}
+
+void portal::arm_deadline(unsigned long timeout) {
+	if (timeout)
+		timers.arm(deadline, std::chrono::milliseconds(timeout));
+	else
+		deadline.cancel();
+}
+
+portal::portal(ekutils::tcp_socket_d && sock, ekutils::epoll_d & p, hosts_db::mailbox & box, backend_pool & pool,
+		timer_wheel & wheel, uring * io_ring) :
+	id(globl_id++), from(std::move(sock)), poll(p), mailbox(box), backends(pool), timers(wheel), ring(io_ring),
+	ctx(std::make_unique<handshake_ctx>(conf->default_server)) {
+	to.traffic = metrics::counter_t::bytes_downstream;
+}
+
+portal::~portal() {
+	if (tunneled)
+		stats->add(record_stats::counter_t::tunnels_closed);
+	if (ringed) {
+		ring_shutdown();
+		for (flow & f : flows)
+			for (std::size_t i = f.sending ? 1 : 0; i < f.queue.size(); i++)
+				ring->recycle(f.queue[i].buffer);
+	}
 }
 
-portal::portal(ekutils::tcp_socket_d && sock, ekutils::epoll_d & p) :
-	id(globl_id++), from(std::move(sock)), poll(p), rec(std::ref(conf->default_server)),
-	vars(main_vars, srv_vars, f_vars, i_vars, hs, env_vars) {}
+void portal::attach(slab_handle handle, timer_wheel::action_t && expired) {
+	self = handle;
+	deadline.bind(std::move(expired));
+	// Slow clients can't hold the connection before the tunnel is ready
+	arm_deadline(conf->handshake_timeout);
+}
 
 void portal::on_from_event(std::uint32_t events) {
 	using namespace ekutils;
+	active = true;
 	try {
 		if (events & actions::rdhup) {
 			// Just disconnect event from client
@@ -314,28 +650,36 @@ void portal::on_from_event(std::uint32_t events) {
 		if (events & actions::err) {
 			// Disconnect with async error
 			int err = errno;
-			log_debug("async connection error received from client #" + std::to_string(id));
+			lazy_debug("async connection error received from client #" + std::to_string(id));
 			throw std::system_error(std::make_error_code(std::errc(err)), "async error");
 		}
 		if (events & actions::in) {
 			// New data for work has received
-			from.receive();
-			//std::int32_t id, sz;
-			//while (from.head(id, sz))
-			process_from_request();
+			if (from_s == state_t::proxy || from_s == state_t::proxy_stable) {
+				// Tunnel reads straight into the backend gate
+				from_proxy();
+			} else {
+				from.receive();
+				//std::int32_t id, sz;
+				//while (from.head(id, sz))
+				process_from_request();
+			}
 		}
 		if (events & actions::out) {
 			// Out information is ready to be send
-			from.send();
+			from.send_ready();
+			if (to.spliced() || to.is_throttled())
+				to_proxy();
 		}
 	} catch (const std::exception & e) {
-		log_error("connection error on client #" + std::to_string(id));
-		log_error(e);
+		lazy_error("connection error on client #" + std::to_string(id));
+		lazy_error(e);
 		disconnect();
 	}
 }
 
 void portal::on_to_event(std::uint32_t events) {
+	active = true;
 	try {
 		using namespace ekutils;
 		if (events & actions::rdhup) {
@@ -347,7 +691,10 @@ void portal::on_to_event(std::uint32_t events) {
 			switch (to_s) {
 				case state_t::connect: {
 					// Close server gate and send fake status instead
+					metrics::local().add(metrics::counter_t::connect_failures);
 					set_from_state_by_hs();
+					// Fake response gets a new handshake deadline
+					arm_deadline(conf->handshake_timeout);
 					poll.remove(to.sock);
 					return;
 				}
@@ -362,14 +709,16 @@ void portal::on_to_event(std::uint32_t events) {
 				case state_t::connect:
 				case state_t::proxy: {
 					// Close server gate and send fake status instead
+					metrics::local().add(metrics::counter_t::connect_failures);
 					set_from_state_by_hs();
-					log_debug("error occured while backend " + std::string(to.sock.remote_endpoint())
+					arm_deadline(conf->handshake_timeout);
+					lazy_debug("error occured while backend " + std::string(to.sock.remote_endpoint())
 						+ " connect process: " + std::make_error_code(std::errc(errno)).message());
 					if (from.avail_read() < 2) {
-						if (hs.state() == 1)
+						if (ctx->hs.state() == 1)
 							from.kostilA();
 						else
-							from.kostilB(nickname);
+							from.kostilB(ctx->nickname);
 					}
 					process_from_request();
 					to.sock.close();
@@ -378,15 +727,19 @@ void portal::on_to_event(std::uint32_t events) {
 				default: {
 					// Disconnect with async error
 					int err = errno;
-					log_debug("async connection error received from client #" + std::to_string(id) + ", state #" + std::to_string(int(to_s)));
+					lazy_debug("async connection error received from client #" + std::to_string(id) + ", state #" + std::to_string(int(to_s)));
 					throw std::system_error(std::make_error_code(std::errc(err)), "async error");
 				}
 			}
 		}
 		if (events & actions::in) {
 			// New data for work has received
-			to.receive();
-			process_to_request();
+			if (to_s == state_t::proxy || to_s == state_t::proxy_stable) {
+				to_proxy();
+			} else {
+				to.receive();
+				process_to_request();
+			}
 		}
 		if (events & actions::out) {
 			switch (to_s) {
@@ -396,11 +749,13 @@ void portal::on_to_event(std::uint32_t events) {
 						err = to.sock.last_error();
 					if (err == std::errc(0)) {
 						// Async connection established
-						log_verbose("async connection #" + std::to_string(id) + " established");
+						lazy_verbose("async connection #" + std::to_string(id) + " established");
 						to_send_new_hs();
 					} else {
-						log_verbose("async connection #" + std::to_string(id) + " to backend server failed");
+						lazy_verbose("async connection #" + std::to_string(id) + " to backend server failed");
+						metrics::local().add(metrics::counter_t::connect_failures);
 						set_from_state_by_hs();
+						arm_deadline(conf->handshake_timeout);
 						to.sock.close(); // This step will destroy current lambda object, not safe
 						return;
 					}
@@ -408,9 +763,15 @@ void portal::on_to_event(std::uint32_t events) {
 				}
 				default:
 					// Out information is ready to be send
-					to.send();
+					to.send_ready();
 					to_s = state_t::proxy_stable;
 					from_s = state_t::proxy_stable;
+					if (conf->splice && !ring) {
+						from.enable_splice();
+						to.enable_splice();
+					}
+					// Portal is a pure byte tunnel from now on
+					ctx.reset();
 					process_from_request();
 					break;
 			}
@@ -422,29 +783,36 @@ void portal::on_to_event(std::uint32_t events) {
 				err = to.sock.last_error();
 			if (err == std::errc(0)) {
 				// Async connection established
-				log_verbose("async connection #" + std::to_string(id) + " established");
+				lazy_verbose("async connection #" + std::to_string(id) + " established");
 				to_send_new_hs();
 				return;
 			} else {
-				log_verbose("async connection #" + std::to_string(id) + " to backend server failed");
+				lazy_verbose("async connection #" + std::to_string(id) + " to backend server failed");
+				metrics::local().add(metrics::counter_t::connect_failures);
 				set_from_state_by_hs();
+				arm_deadline(conf->handshake_timeout);
 				if (from.avail_read() < 2) {
-					if (hs.state() == 1)
+					if (ctx->hs.state() == 1)
 						from.kostilA();
 					else
-						from.kostilB(nickname);
+						from.kostilB(ctx->nickname);
 				}
 				to.sock.close(); // This step will destroy current lambda object, not safe
 				return;
 			}
 		}
-		log_error("connection error on backend server \"" + hs.address() + '\"');
-		log_error(e);
+		if (ctx)
+			lazy_error("connection error on backend server \"" + ctx->hs.address() + '\"');
+		else
+			lazy_error("connection error on backend server of connection #" + std::to_string(id));
+		lazy_error(e);
 		disconnect();
 	}
 }
 
 void portal::on_disconnect() {
+	if (!ctx)
+		return; // Stable tunnels are just closed
 	try {
 		// Not nessesary
 		pakets::disconnect dc;
@@ -453,17 +821,178 @@ void portal::on_disconnect() {
 	} catch (...) {}
 }
 
+void portal::on_resolved(const hosts_db::answer_t & addresses) {
+	if (disconnected || to_s != state_t::resolve)
+		return;
+	try {
+		connect_backend(addresses);
+	} catch (const std::exception & e) {
+		lazy_error("backend connection error on client #" + std::to_string(id));
+		lazy_error(e);
+		disconnect();
+	}
+}
+
 void portal::on_timeout() {
-	switch (to_s) {
-		case state_t::connect:
-			set_from_state_by_hs();
-			to.sock.close();
-			log_debug("connection timeout #" + std::to_string(id));
-			process_from_request();
+	try {
+		switch (to_s) {
+			case state_t::connect:
+				if (from_s != state_t::wait)
+					break;
+				metrics::local().add(metrics::counter_t::connect_timeouts);
+				set_from_state_by_hs();
+				to.sock.close();
+				lazy_debug("connection timeout #" + std::to_string(id));
+				// Fake response gets a new handshake deadline
+				arm_deadline(conf->handshake_timeout);
+				process_from_request();
+				return;
+			case state_t::resolve:
+				if (from_s != state_t::wait)
+					break;
+				// Late answer is ignored, the player gets the fake response
+				metrics::local().add(metrics::counter_t::connect_timeouts);
+				lazy_debug("backend name resolution timeout #" + std::to_string(id));
+				to_s = state_t::wait;
+				set_from_state_by_hs();
+				arm_deadline(conf->handshake_timeout);
+				process_from_request();
+				return;
+			case state_t::proxy:
+			case state_t::proxy_stable:
+				if (active) {
+					// Tunnel is checked once per idle_timeout, not on every event
+					active = false;
+					arm_deadline(conf->idle_timeout);
+					return;
+				}
+				lazy_verbose("connection #" + std::to_string(id) + " is idle for too long");
+				metrics::local().add(metrics::counter_t::idle_timeouts);
+				disconnect();
+				return;
+			default:
+				break;
+		}
+		lazy_verbose("connection #" + std::to_string(id) + " missed the handshake deadline");
+		metrics::local().add(metrics::counter_t::handshake_timeouts);
+		disconnect();
+	} catch (const std::exception & e) {
+		lazy_error("connection error on client #" + std::to_string(id));
+		lazy_error(e);
+		disconnect();
+	}
+}
+
+std::atomic<unsigned long> portal::ring_tunnels = 0;
+
+bool portal::ring_ready() const noexcept {
+	return ring && !ringed && !disconnected && to_s == state_t::proxy_stable
+		&& !from.avail_read() && !from.avail_write() && !to.avail_read() && !to.avail_write()
+		&& !from.is_throttled() && !to.is_throttled();
+}
+
+void portal::try_ring() {
+	if (!ring_ready())
+		return;
+	poll.remove(from.sock);
+	poll.remove(to.sock);
+	ringed = true;
+	ring_tunnels++;
+	lazy_debug("tunnel #" + std::to_string(id) + " moved to io_uring");
+	ring_receive(0);
+	ring_receive(1);
+}
+
+std::uint64_t portal::ring_data(bool send, unsigned dir) const noexcept {
+	return (std::uint64_t(self.index) << 34) | (std::uint64_t(send) << 33) | (std::uint64_t(dir) << 32) | self.generation;
+}
+
+void portal::ring_receive(unsigned dir) {
+	flow & f = flows[dir];
+	// Full window holds the bytes in the socket, like the high watermark
+	if (shut || f.receiving || f.queue.size() >= ring_window)
+		return;
+	// Full ring is retried by the worker like a lack of buffers
+	f.receiving = ring->prepare_recv((dir ? to : from).sock.get_handle(), ring_data(false, dir));
+	if (!f.receiving)
+		f.starved = true;
+}
+
+void portal::ring_send(unsigned dir) {
+	flow & f = flows[dir];
+	// One send at a time keeps the bytes in order
+	if (shut || f.sending || f.queue.empty())
+		return;
+	const chunk & head = f.queue.front();
+	f.sending = ring->prepare_send((dir ? from : to).sock.get_handle(), ring->buffer(head.buffer) + head.offset,
+		head.length, ring_data(true, dir));
+	if (!f.sending)
+		f.starved = true;
+}
+
+void portal::on_ring(const uring::completion & result) {
+	bool send = result.data & (std::uint64_t(1) << 33);
+	unsigned dir = unsigned(result.data >> 32) & 1;
+	flow & f = flows[dir];
+	active = true;
+	if (send) {
+		f.sending = false;
+		if (result.result < 0) {
+			if (!shut)
+				lazy_debug("tunnel #" + std::to_string(id) + " send failed: " + std::generic_category().message(-result.result));
+			disconnect();
 			return;
-		default:
+		}
+		chunk & head = f.queue.front();
+		head.offset += std::uint32_t(result.result);
+		head.length -= std::uint32_t(result.result);
+		if (!head.length) {
+			ring->recycle(head.buffer);
+			f.queue.pop_front();
+		}
+	} else {
+		f.receiving = false;
+		if (result.result == -ENOBUFS && !shut) {
+			// Worker resumes the flow when buffers are recycled
+			f.starved = true;
+			return;
+		}
+		if (result.result <= 0) {
+			if (result.buffer != -1)
+				ring->recycle(result.buffer);
+			if (result.result < 0 && !shut)
+				lazy_debug("tunnel #" + std::to_string(id) + " receive failed: " + std::generic_category().message(-result.result));
+			disconnect();
 			return;
+		}
+		(dir ? to : from).account(std::size_t(result.result));
+		f.queue.push_back({ result.buffer, 0, std::uint32_t(result.result) });
 	}
+	ring_send(dir);
+	ring_receive(dir);
+}
+
+bool portal::ring_busy() const noexcept {
+	return flows[0].receiving || flows[0].sending || flows[1].receiving || flows[1].sending;
+}
+
+void portal::ring_resume() {
+	for (unsigned dir : { 0u, 1u }) {
+		if (!flows[dir].starved)
+			continue;
+		flows[dir].starved = false;
+		ring_send(dir);
+		ring_receive(dir);
+	}
+}
+
+void portal::ring_shutdown() noexcept {
+	if (shut)
+		return;
+	shut = true;
+	// Wakes up receives in flight, peers see the end of stream
+	::shutdown(from.sock.get_handle(), SHUT_RDWR);
+	::shutdown(to.sock.get_handle(), SHUT_RDWR);
 }
 
 } // namespace mcshub
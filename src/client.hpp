@@ -4,8 +4,8 @@
 #include <future>
 #include <atomic>
 #include <cassert>
+#include <deque>
 
-#include <ekutils/expandbuff.hpp>
 #include <ekutils/socket_d.hpp>
 #include <ekutils/primitives.hpp>
 #include <ekutils/epoll_d.hpp>
@@ -13,6 +13,18 @@
 #include "settings.hpp"
 #include "mc_pakets.hpp"
 #include "response_props.hpp"
+#include "splice_pipe.hpp"
+#include "buffer_pool.hpp"
+#include "hosts_db.hpp"
+#include "backend_pool.hpp"
+#include "balancer.hpp"
+#include "health.hpp"
+#include "status_cache.hpp"
+#include "slab.hpp"
+#include "timer_wheel.hpp"
+#include "metrics.hpp"
+#include "record_stats.hpp"
+#include "uring.hpp"
 
 namespace mcshub {
 
@@ -27,57 +39,166 @@ public:
 class gate {
 public:
 private:
-	ekutils::expandbuff input, output;
+	io_buffer input, output;
+	splice_pipe pipe;
+	bool zero_copy = false, splice_broken = false;
+	bool throttled = false;
+	// Cleared when the socket send buffer is full, set again by EPOLLOUT
+	bool writable = true;
+	std::size_t read_chunk = min_read_chunk;
+	void throttle(bool value) noexcept;
+	// Reads until the socket is drained or buff holds limit bytes, 0 is no limit
+	std::size_t read_to(io_buffer & buff, std::size_t limit, bool & drained);
 public:
+	static constexpr std::size_t min_read_chunk = 4096;
+	static constexpr std::size_t max_read_chunk = 65536;
+	static std::atomic<unsigned long> throttled_gates;
+	static std::atomic<unsigned long> throttle_events;
+	static std::atomic<unsigned long long> receive_events;
+	static std::atomic<unsigned long long> read_calls;
+	static std::atomic<unsigned long long> spliced_bytes;
+	// Reads after the first one of a receive event. FIONREAD took one
+	// more syscall on every event before.
+	static unsigned long long extra_reads() noexcept {
+		unsigned long long events = receive_events, reads = read_calls;
+		return reads > events ? reads - events : 0;
+	}
 	ekutils::tcp_socket_d sock;
+	// Counts bytes that this gate passes to the other one
+	metrics::counter_t traffic = metrics::counter_t::bytes_upstream;
+	// Statistics of the server record, set after the handshake
+	record_stats::slot * record = nullptr;
 	gate() {}
 	explicit gate(ekutils::tcp_socket_d && socket) : sock(std::move(socket)) {}
+	~gate() {
+		throttle(false);
+	}
+	// Counts bytes that were received to be passed to the other gate
+	void account(std::size_t bytes) noexcept;
 	bool head(std::int32_t & id, std::int32_t & size) const;
 	template <typename P>
 	bool paket_read(P & packet);
 	template <typename P>
 	void paket_write(const P & packet);
+	void write(const byte_t * data, std::size_t size);
 	void kostilA();
 	void kostilB(const std::string & nick);
 	void tunnel(gate & other);
+	bool splice(gate & other);
+	void forward(gate & other, std::size_t high, std::size_t low);
 	void receive();
 	void send();
+	void send_ready() {
+		writable = true;
+		send();
+	}
 	std::size_t avail_read() const noexcept {
 		return input.size();
 	}
 	std::size_t avail_write() const noexcept {
 		return output.size();
 	}
+	void enable_splice() noexcept {
+		if (!splice_broken)
+			zero_copy = true;
+	}
+	std::size_t read_size() const noexcept {
+		return read_chunk;
+	}
+	bool spliced() const noexcept {
+		return zero_copy;
+	}
+	bool is_throttled() const noexcept {
+		return throttled;
+	}
 };
 
 class portal {
 	static std::atomic<long> globl_id;
-	std::string nickname;
+	typedef vars_manager<main_vars_t, server_vars, file_vars, img_vars, pakets::handshake, env_vars_t, agg_vars> hub_vars;
+	// State that is needed only until the tunnel becomes stable
+	struct handshake_ctx {
+		pakets::handshake hs;
+		std::string nickname;
+		std::string server_name;
+		// Same record in every configuration generation
+		std::string record_name;
+		server_vars srv_vars {};
+		file_vars f_vars;
+		img_vars i_vars;
+		std::reference_wrapper<const settings::basic_record> rec;
+		// Real backend status that is served instead of the fake one
+		health_checker::status_t live_status;
+		// Sum of the backend statuses for aggregated records
+		health_checker::aggregate_t aggregate;
+		agg_vars a_vars;
+		// When the handshake was read, for the backend latency histogram
+		std::chrono::steady_clock::time_point started;
+		hub_vars vars;
+		explicit handshake_ctx(const settings::basic_record & record) :
+				rec(record), vars(main_vars, srv_vars, f_vars, i_vars, hs, env_vars, a_vars) {
+			handshake_states++;
+		}
+		~handshake_ctx() {
+			handshake_states--;
+		}
+		handshake_ctx(const handshake_ctx &) = delete;
+		handshake_ctx & operator=(const handshake_ctx &) = delete;
+	};
 	long id;
-	int timeout;
 	gate from, to;
 	ekutils::epoll_d & poll;
-	pakets::handshake hs;
-	std::string server_name;
-	server_vars srv_vars;
-	file_vars f_vars;
-	img_vars i_vars;
+	hosts_db::mailbox & mailbox;
+	backend_pool & backends;
+	timer_wheel & timers;
+	// Connect timeout, handshake deadline or idle timeout, by the state
+	timer_wheel::timer deadline;
+	// Tunnel forwarded something since the idle timer was armed
+	bool active = false;
+	// Statistics of the server record and whether a backend tunnel was counted there
+	record_stats::slot * stats = nullptr;
+	bool tunneled = false;
+	slab_handle self;
+	// Stable tunnels move to the ring of the worker, nullptr with epoll
+	uring * ring;
+	// Received bytes in a provided buffer that are not sent yet
+	struct chunk {
+		int buffer;
+		std::uint32_t offset, length;
+	};
+	// Direction of a tunnel on the ring, 0 is from the client
+	struct flow {
+		std::deque<chunk> queue;
+		bool receiving = false, sending = false;
+		// Receive failed while every buffer was taken
+		bool starved = false;
+	} flows[2];
+	bool ringed = false, shut = false;
 	conf_snap conf;
-	std::reference_wrapper<const settings::basic_record> rec;
-	vars_manager<main_vars_t, server_vars, file_vars, img_vars, pakets::handshake, env_vars_t> vars;
+	std::unique_ptr<handshake_ctx> ctx;
+	balancer::lease backend;
 	enum class state_t {
-		handshake, connect, wait, status_fake, login_fake, login, proxy, proxy_stable, ping
-	} from_s = state_t::handshake, to_s;
+		handshake, pick, resolve, connect, wait, status_fake, login_fake, login, proxy, proxy_stable, ping
+	} from_s = state_t::handshake, to_s = state_t::handshake;
 	bool disconnected = false;
 	void disconnect() noexcept {
 		disconnected = true;
 	}
 	void set_from_state_by_hs();
 	const settings::basic_record & record(const conf_snap & conf);
+	std::string load_status();
+	std::string load_login();
+	// Template of the record compiled once per configuration generation
+	const compiled_template & compiled(status_cache::template_t kind);
 	std::string resolve_status();
+	void send_status();
 	std::string resolve_login();
 	void process_from_request();
 	void from_handshake();
+	void from_pick();
+	void connect_upstream(std::string_view key = {});
+	void connect_backend(const hosts_db::answer_t & addresses);
+	void watch_backend();
 	void from_login();
 	void from_fake_status();
 	void from_fake_login();
@@ -85,8 +206,22 @@ class portal {
 	void process_to_request();
 	void to_send_new_hs();
 	void to_proxy();
+	void arm_deadline(unsigned long timeout);
+	std::uint64_t ring_data(bool send, unsigned dir) const noexcept;
+	void ring_receive(unsigned dir);
+	void ring_send(unsigned dir);
 public:
-	portal(ekutils::tcp_socket_d && sock, ekutils::epoll_d & p);
+	// Buffers that one direction of a tunnel holds on the ring
+	static constexpr std::size_t ring_window = 4;
+	static std::atomic<unsigned long> ring_tunnels;
+	// Portals that still hold their handshake state
+	static std::atomic<unsigned long> handshake_states;
+	portal(ekutils::tcp_socket_d && sock, ekutils::epoll_d & p, hosts_db::mailbox & box, backend_pool & pool,
+		timer_wheel & wheel, uring * io_ring);
+	~portal();
+	// Handle of this portal in the worker, DNS answers are addressed to it.
+	// The action is called by the worker when the deadline expires.
+	void attach(slab_handle handle, timer_wheel::action_t && expired);
 	bool is_disconnected() const noexcept {
 		return disconnected;
 	}
@@ -96,8 +231,23 @@ public:
 	void on_from_event(std::uint32_t events);
 	void on_to_event(std::uint32_t events);
 	void on_disconnect();
-private:
+	void on_resolved(const hosts_db::answer_t & addresses);
 	void on_timeout();
+	// Tunnel has nothing buffered and can move to the ring
+	bool ring_ready() const noexcept;
+	// Leaves epoll, the worker calls it outside of epoll handlers
+	void try_ring();
+	static slab_handle ring_owner(std::uint64_t data) noexcept {
+		return { std::uint32_t(data >> 34), std::uint32_t(data) };
+	}
+	void on_ring(const uring::completion & result);
+	bool ring_busy() const noexcept;
+	bool is_starved() const noexcept {
+		return flows[0].starved || flows[1].starved;
+	}
+	void ring_resume();
+	// Completes the operations in flight, the portal is erased after them
+	void ring_shutdown() noexcept;
 };
 
 } // namespace mcshub
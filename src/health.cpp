@@ -0,0 +1,634 @@
+#include "health.hpp"
+
+#include <atomic>
+#include <algorithm>
+#include <unordered_set>
+#include <system_error>
+
+#include <poll.h>
+#include <sys/socket.h>
+
+#include <yaml-cpp/yaml.h>
+#include <ekutils/log.hpp>
+#include <ekutils/socket_d.hpp>
+#include <ekutils/mutex_atomic.hpp>
+
+#include "mc_pakets.hpp"
+#include "sclient.hpp"
+#include "record_stats.hpp"
+#include "logging.hpp"
+
+namespace mcshub {
+
+namespace {
+
+unsigned long status_period(const settings::basic_record & record) {
+	if (record.aggregate && !record.status_ttl)
+		return health_checker::aggregate_period;
+	return record.status_ttl;
+}
+
+std::string json_quote(const std::string & str) {
+	static const char hex[] = "0123456789abcdef";
+	std::string result = "\"";
+	for (char c : str) {
+		switch (c) {
+			case '"':
+				result += "\\\"";
+				break;
+			case '\\':
+				result += "\\\\";
+				break;
+			default:
+				if (std::uint8_t(c) < 0x20) {
+					result += "\\u00";
+					result += hex[std::uint8_t(c) >> 4];
+					result += hex[c & 0xf];
+				} else {
+					result += c;
+				}
+		}
+	}
+	result += '"';
+	return result;
+}
+
+ekutils::matomic<std::shared_ptr<const health_checker::view_t>> published_view;
+std::atomic<unsigned long> published_revision = 0;
+thread_local std::shared_ptr<const health_checker::view_t> local_view;
+thread_local bool view_quiescent = false;
+
+inline void refresh_local_view() {
+	unsigned long revision = published_revision.load(std::memory_order_acquire);
+	if (!local_view || local_view->revision != revision)
+		local_view = published_view;
+}
+
+// Status request of one round, moved forward by the events of its socket
+struct probe {
+	typedef health_checker::clock clock;
+	enum class step_t {
+		resolve, connect, exchange, done
+	};
+	std::string host;
+	std::uint16_t port = 0;
+	clock::time_point start, deadline;
+	step_t step = step_t::resolve;
+	ekutils::tcp_socket_d sock;
+	std::vector<ekutils::byte_t> output, input;
+	std::size_t sent = 0;
+	std::chrono::milliseconds latency { 0 };
+	std::string message, error;
+
+	void fail(const std::string & reason) {
+		error = reason;
+		step = step_t::done;
+		if (sock.is_valid())
+			sock.close();
+	}
+	void expire() {
+		switch (step) {
+			case step_t::resolve:
+				return fail("name resolution timed out");
+			case step_t::connect:
+				return fail("connection timed out");
+			default:
+				return fail("server response timed out");
+		}
+	}
+	void connect(const hosts_db::answer_t & addresses) {
+		if (!addresses)
+			return fail("name can't be resolved");
+		try {
+			sock.open(*addresses, ekutils::tcp_flags::non_blocking);
+		} catch (const std::exception & e) {
+			return fail(e.what());
+		}
+		output = sclient::status_request(host, port);
+		step = step_t::connect;
+	}
+	short events() const noexcept {
+		switch (step) {
+			case step_t::connect:
+				return POLLOUT;
+			case step_t::exchange:
+				return sent < output.size() ? POLLIN | POLLOUT : POLLIN;
+			default:
+				return 0;
+		}
+	}
+	void advance(short revents) {
+		try {
+			if (step == step_t::connect) {
+				std::errc err = sock.last_error();
+				if (err != std::errc(0))
+					throw std::system_error(std::make_error_code(err), "connect");
+				step = step_t::exchange;
+			}
+			int fd = sock.get_handle();
+			while (sent < output.size()) {
+				ssize_t r = ::send(fd, output.data() + sent, output.size() - sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+				if (r == -1) {
+					if (errno == EAGAIN || errno == EWOULDBLOCK)
+						return;
+					throw std::system_error(errno, std::generic_category(), "send");
+				}
+				sent += std::size_t(r);
+			}
+			if (!(revents & (POLLIN | POLLHUP | POLLERR)))
+				return;
+			bool closed = false;
+			while (!closed) {
+				ekutils::byte_t buffer[4096];
+				ssize_t r = ::recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+				closed = r == 0;
+				if (r == -1) {
+					if (errno == EAGAIN || errno == EWOULDBLOCK)
+						break;
+					throw std::system_error(errno, std::generic_category(), "recv");
+				}
+				input.insert(input.end(), buffer, buffer + r);
+			}
+			pakets::response response;
+			if (!sclient::parse_paket(input.data(), input.size(), response)) {
+				if (closed)
+					throw std::runtime_error("server closed connection");
+				return;
+			}
+			message = std::move(response.message());
+			latency = std::chrono::duration_cast<std::chrono::milliseconds>(clock::now() - start);
+			step = step_t::done;
+			sock.close();
+		} catch (const std::exception & e) {
+			fail(e.what());
+		}
+	}
+};
+
+} // namespace
+
+health_checker::~health_checker() {
+	stop();
+}
+
+void health_checker::start() {
+	std::lock_guard lock(wake_mutex);
+	if (thread.joinable())
+		return;
+	stopping = false;
+	thread = std::thread([this]() { run(); });
+}
+
+void health_checker::stop() {
+	{
+		std::lock_guard lock(wake_mutex);
+		stopping = true;
+	}
+	wake.notify_all();
+	if (thread.joinable())
+		thread.join();
+}
+
+std::string health_checker::key_of(const std::string & address, std::uint16_t port) {
+	return address + ':' + std::to_string(port);
+}
+
+std::vector<health_checker::target> health_checker::collect(const settings & conf) {
+	std::vector<target> result;
+	std::unordered_map<std::string, std::size_t> indices;
+	auto add = [&](const std::string & address, std::uint16_t port, unsigned long status_ttl, bool cache) {
+		unsigned long period = conf.health_interval;
+		if (status_ttl && (!period || status_ttl < period))
+			period = status_ttl;
+		if (address.empty() || !port || !period)
+			return;
+		auto [iter, fresh] = indices.emplace(key_of(address, port), result.size());
+		if (fresh) {
+			result.push_back({ address, port, std::chrono::milliseconds(period), cache });
+			return;
+		}
+		target & t = result[iter->second];
+		if (std::chrono::milliseconds(period) < t.period)
+			t.period = std::chrono::milliseconds(period);
+		t.cache = t.cache && cache;
+	};
+	auto visit = [&](const settings::basic_record & record) {
+		if (record.drop)
+			return;
+		unsigned long status_ttl = status_period(record);
+		// Same as for portals
+		bool cache = conf.dns_cache && !record.mcsman;
+		if (record.upstreams.empty())
+			add(record.address, record.port, status_ttl, cache);
+		for (const auto & upstream : record.upstreams)
+			add(upstream.address, upstream.port, status_ttl, cache);
+	};
+	auto visit_server = [&](const settings::server_record & record) {
+		visit(record);
+		if (record.fml)
+			visit(*record.fml);
+	};
+	visit_server(conf.default_server);
+	for (const auto & [name, record] : conf.servers)
+		visit_server(record);
+	return result;
+}
+
+std::vector<health_checker::outcome> health_checker::probe_all(const std::vector<target> & targets,
+		std::chrono::milliseconds timeout, const hosts_db::ttl_t & ttl, hosts_db::mailbox & box) {
+	// Answers of the cancelled requests of previous rounds are ignored
+	static std::atomic<std::uint32_t> rounds = 0;
+	std::uint32_t round = ++rounds;
+	hosts_db & db = hosts_db::instance();
+	std::vector<probe> probes(targets.size());
+	std::vector<outcome> results(targets.size());
+	auto now = clock::now();
+	for (std::size_t i = 0, size = targets.size(); i < size; i++) {
+		const target & t = targets[i];
+		probe & p = probes[i];
+		p.host = t.address;
+		if (p.host.back() == '.')
+			p.host.pop_back();
+		p.port = t.port;
+		p.start = now;
+		p.deadline = now + timeout;
+		hosts_db::answer_t addresses;
+		if (t.cache && db.find(p.host, p.port, addresses))
+			p.connect(addresses);
+		else
+			db.resolve(p.host, p.port, t.cache ? ttl : hosts_db::ttl_t { std::chrono::seconds(0), std::chrono::seconds(0) },
+				box, slab_handle { std::uint32_t(i), round });
+	}
+	std::vector<pollfd> fds;
+	std::vector<std::size_t> owners;
+	std::vector<hosts_db::completion> answers;
+	for (;;) {
+		now = clock::now();
+		clock::time_point wake = clock::time_point::max();
+		fds.assign(1, pollfd { box.get_handle(), POLLIN, 0 });
+		owners.clear();
+		for (std::size_t i = 0, size = probes.size(); i < size; i++) {
+			probe & p = probes[i];
+			if (p.step == probe::step_t::done)
+				continue;
+			if (now >= p.deadline) {
+				p.expire();
+				continue;
+			}
+			wake = std::min(wake, p.deadline);
+			if (short events = p.events()) {
+				fds.push_back({ p.sock.get_handle(), events, 0 });
+				owners.push_back(i);
+			}
+		}
+		if (wake == clock::time_point::max())
+			break;
+		auto left = std::chrono::duration_cast<std::chrono::milliseconds>(wake - now) + std::chrono::milliseconds(1);
+		int ready = ::poll(fds.data(), fds.size(), int(left.count()));
+		if (ready == -1) {
+			if (errno == EINTR)
+				continue;
+			std::string error = std::system_error(errno, std::generic_category(), "poll").what();
+			for (probe & p : probes)
+				if (p.step != probe::step_t::done)
+					p.fail(error);
+			break;
+		}
+		if (fds[0].revents & POLLIN) {
+			box.take(answers);
+			for (const auto & answer : answers) {
+				if (answer.client.generation != round || answer.client.index >= probes.size())
+					continue;
+				probe & p = probes[answer.client.index];
+				if (p.step == probe::step_t::resolve)
+					p.connect(answer.answer);
+			}
+			answers.clear();
+		}
+		for (std::size_t k = 1, size = fds.size(); k < size; k++)
+			if (fds[k].revents)
+				probes[owners[k - 1]].advance(fds[k].revents);
+	}
+	db.cancel(box);
+	for (std::size_t i = 0, size = probes.size(); i < size; i++) {
+		results[i].latency = probes[i].latency;
+		results[i].message = std::move(probes[i].message);
+		results[i].error = std::move(probes[i].error);
+	}
+	return results;
+}
+
+std::chrono::milliseconds health_checker::check(const std::string & address, std::uint16_t port,
+		std::chrono::milliseconds timeout, std::string * message) {
+	hosts_db::mailbox box;
+	auto results = probe_all({ { address, port, timeout, false } }, timeout, {}, box);
+	outcome & result = results.front();
+	if (!result.error.empty())
+		throw std::runtime_error(result.error);
+	if (message)
+		*message = std::move(result.message);
+	return result.latency;
+}
+
+void health_checker::apply(const target & t, const outcome & result, const settings & conf) {
+	const std::string & error = result.error;
+	const std::string & message = result.message;
+	std::chrono::milliseconds latency = result.latency;
+	status_t status;
+	players_t players;
+	if (error.empty()) {
+		status = std::make_shared<const status_cache::frame_t>(status_cache::serialize(message));
+		if (!parse_players(message, players))
+			lazy_debug("no players in the status of " + key_of(t.address, t.port));
+	}
+	std::unique_lock lock(mutex);
+	backend_health & health = backends[key_of(t.address, t.port)];
+	health.address = t.address;
+	health.port = t.port;
+	health.checked = clock::now();
+	const std::string name = t.address + ":" + std::to_string(t.port);
+	if (error.empty()) {
+		if (health.state == state_t::down)
+			lazy_info("backend " + name + " is up again");
+		health.state = state_t::up;
+		health.fails = 0;
+		health.latency = latency;
+		health.error.clear();
+		health.status = std::move(status);
+		health.status_time = health.checked;
+		health.players = std::move(players);
+	} else {
+		health.fails++;
+		health.error = error;
+		// Probes for the status cache only don't make backends down
+		if (conf.health_interval && health.state != state_t::down && health.fails >= conf.health_fails) {
+			health.state = state_t::down;
+			lazy_warning("backend " + name + " is down: " + error);
+		}
+	}
+}
+
+bool health_checker::parse_players(const std::string & message, players_t & result) {
+	try {
+		// JSON is a subset of YAML
+		YAML::Node players = YAML::Load(message)["players"];
+		if (!players || !players.IsMap())
+			return false;
+		if (auto online = players["online"])
+			result.online = online.as<long>();
+		if (auto max = players["max"])
+			result.max = max.as<long>();
+		auto sample = players["sample"];
+		if (sample && sample.IsSequence()) {
+			for (const auto & player : sample) {
+				if (!player.IsMap() || !player["name"])
+					continue;
+				auto id = player["id"];
+				result.sample.emplace_back(player["name"].as<std::string>(), id ? id.as<std::string>() : std::string());
+			}
+		}
+		return true;
+	} catch (const YAML::Exception &) {
+		return false;
+	}
+}
+
+aggregate_status health_checker::merge(const std::vector<const players_t *> & live, unsigned total) {
+	aggregate_status result;
+	result.live = unsigned(live.size());
+	result.total = total;
+	std::string sample = "[";
+	std::size_t count = 0;
+	for (const players_t * players : live) {
+		result.online += players->online;
+		result.max += players->max;
+		for (const auto & [name, id] : players->sample) {
+			if (count == sample_limit)
+				break;
+			if (count++)
+				sample += ',';
+			sample += "{\"name\":" + json_quote(name) + ",\"id\":" + json_quote(id) + '}';
+		}
+	}
+	sample += ']';
+	result.sample = std::move(sample);
+	return result;
+}
+
+void health_checker::summarize(const settings & conf) {
+	auto now = clock::now();
+	std::unordered_map<std::string, aggregate_t> result;
+	std::unique_lock lock(mutex);
+	auto visit = [&](const settings::basic_record & record, const std::string & name) {
+		if (!record.aggregate || record.drop)
+			return;
+		// Same freshness as for the real statuses served by portals
+		std::chrono::milliseconds max_age(2 * status_period(record));
+		std::vector<const players_t *> live;
+		unsigned total = 0;
+		auto add = [&](const std::string & address, std::uint16_t port) {
+			if (address.empty() || !port)
+				return;
+			total++;
+			auto iter = backends.find(key_of(address, port));
+			if (iter == backends.end())
+				return;
+			const backend_health & health = iter->second;
+			if (health.status && health.state != state_t::down && now - health.status_time <= max_age)
+				live.push_back(&health.players);
+		};
+		if (record.upstreams.empty())
+			add(record.address, record.port);
+		for (const auto & upstream : record.upstreams)
+			add(upstream.address, upstream.port);
+		aggregate_status status = merge(live, total);
+		aggregate_t & slot = result[name];
+		// Unchanged sum keeps its revision and the cached responses
+		auto old = aggregates.find(name);
+		if (old != aggregates.end()) {
+			const aggregate_status & prev = *old->second;
+			if (prev.online == status.online && prev.max == status.max && prev.live == status.live &&
+					prev.total == status.total && prev.sample == status.sample) {
+				slot = old->second;
+				return;
+			}
+		}
+		status.revision = ++revisions;
+		slot = std::make_shared<const aggregate_status>(std::move(status));
+	};
+	auto visit_server = [&](const settings::server_record & record, const std::string & name) {
+		visit(record, record_name(name, false));
+		if (record.fml)
+			visit(*record.fml, record_name(name, true));
+	};
+	visit_server(conf.default_server, record_stats::default_name);
+	for (const auto & [name, record] : conf.servers)
+		visit_server(record, name);
+	aggregates = std::move(result);
+	aggregates_generation = conf.generation;
+}
+
+void health_checker::run() {
+	lazy_debug("health checker thread spawned");
+	hosts_db::mailbox box;
+	std::unique_lock lock(wake_mutex);
+	while (!stopping) {
+		auto c = conf_reader::snapshot();
+		lock.unlock();
+		auto targets = collect(*c);
+		std::unordered_set<std::string> keys;
+		std::vector<target> due_targets;
+		auto now = clock::now();
+		for (const auto & t : targets) {
+			std::string key = key_of(t.address, t.port);
+			keys.insert(key);
+			if (schedule[key] <= now)
+				due_targets.push_back(t);
+		}
+		if (!due_targets.empty()) {
+			hosts_db::ttl_t ttl { std::chrono::seconds(c->dns_ttl), std::chrono::seconds(c->dns_negative_ttl) };
+			auto results = probe_all(due_targets, std::chrono::milliseconds(c->health_timeout), ttl, box);
+			now = clock::now();
+			for (std::size_t i = 0, size = due_targets.size(); i < size; i++) {
+				const target & t = due_targets[i];
+				apply(t, results[i], *c);
+				schedule[key_of(t.address, t.port)] = now + t.period;
+			}
+		}
+		auto wake_time = now + std::chrono::seconds(1);
+		for (const auto & t : targets)
+			wake_time = std::min(wake_time, schedule[key_of(t.address, t.port)]);
+		{
+			// Forget backends that are not in the configuration anymore
+			std::unique_lock write(mutex);
+			for (auto iter = backends.begin(); iter != backends.end();) {
+				if (keys.count(iter->first))
+					++iter;
+				else
+					iter = backends.erase(iter);
+			}
+		}
+		for (auto iter = schedule.begin(); iter != schedule.end();) {
+			if (keys.count(iter->first))
+				++iter;
+			else
+				iter = schedule.erase(iter);
+		}
+		summarize(*c);
+		publish();
+		c.reset();
+		lock.lock();
+		wake.wait_until(lock, wake_time, [this]() { return stopping || refresh; });
+		refresh = false;
+	}
+}
+
+const health_checker::view_t::backend_t * health_checker::view_t::find(const std::string & address,
+		std::uint16_t port) const noexcept {
+	auto iter = std::lower_bound(backends.begin(), backends.end(), std::make_pair(port, &address),
+		[](const backend_t & b, const std::pair<std::uint16_t, const std::string *> & key) {
+			return b.port < key.first || (b.port == key.first && b.address < *key.second);
+		});
+	if (iter == backends.end() || iter->port != port || iter->address != address)
+		return nullptr;
+	return &*iter;
+}
+
+void health_checker::publish() {
+	auto result = std::make_shared<view_t>();
+	{
+		std::shared_lock lock(mutex);
+		result->backends.reserve(backends.size());
+		for (const auto & [key, health] : backends)
+			result->backends.push_back({ health.address, health.port, health.state == state_t::down,
+				health.status, health.status_time });
+	}
+	std::sort(result->backends.begin(), result->backends.end(), [](const auto & a, const auto & b) {
+		return a.port < b.port || (a.port == b.port && a.address < b.address);
+	});
+	static unsigned long revisions = 0;
+	unsigned long revision = result->revision = ++revisions;
+	published_view = std::shared_ptr<const view_t>(std::move(result));
+	published_revision.store(revision, std::memory_order_release);
+}
+
+const health_checker::view_t * health_checker::view() {
+	if (!view_quiescent)
+		refresh_local_view();
+	return local_view.get();
+}
+
+void health_checker::quiescent() {
+	view_quiescent = true;
+	refresh_local_view();
+}
+
+health_checker::status_t health_checker::live_status(const std::string & address, std::uint16_t port,
+		std::chrono::milliseconds max_age) {
+	const view_t * v = view();
+	if (!v || v->backends.empty())
+		return nullptr;
+	const view_t::backend_t * health = v->find(address, port);
+	if (!health || !health->status || health->down || clock::now() - health->status_time > max_age)
+		return nullptr;
+	return health->status;
+}
+
+health_checker::aggregate_t health_checker::aggregate(const std::string & name, unsigned long gen) {
+	aggregate_t result;
+	bool outdated;
+	{
+		std::shared_lock lock(mutex);
+		outdated = gen > aggregates_generation;
+		auto iter = aggregates.find(name);
+		if (iter != aggregates.end())
+			result = iter->second;
+	}
+	if (outdated) {
+		{
+			std::lock_guard lock(wake_mutex);
+			refresh = true;
+		}
+		wake.notify_all();
+	}
+	return result;
+}
+
+std::string health_checker::record_name(const std::string & server, bool fml) {
+	return fml ? server + "/fml" : server;
+}
+
+bool health_checker::is_down(const std::string & address, std::uint16_t port) {
+	const view_t * v = view();
+	if (!v || v->backends.empty())
+		return false;
+	const view_t::backend_t * health = v->find(address, port);
+	return health && health->down;
+}
+
+std::vector<health_checker::backend_health> health_checker::report() {
+	std::shared_lock lock(mutex);
+	std::vector<backend_health> result;
+	result.reserve(backends.size());
+	for (const auto & [key, health] : backends)
+		result.push_back(health);
+	return result;
+}
+
+health_checker & health_checker::instance() {
+	static health_checker checker;
+	return checker;
+}
+
+const char * to_string(health_checker::state_t state) noexcept {
+	switch (state) {
+		case health_checker::state_t::up:
+			return "up";
+		case health_checker::state_t::down:
+			return "down";
+		default:
+			return "unknown";
+	}
+}
+
+} // namespace mcshub
@@ -0,0 +1,145 @@
+#ifndef _HEALTH_HEAD
+#define _HEALTH_HEAD
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <unordered_map>
+
+#include "settings.hpp"
+#include "hosts_db.hpp"
+#include "status_cache.hpp"
+
+namespace mcshub {
+
+// Background prober of the configured backends. Every 'health_interval'
+// milliseconds each upstream gets a status request, all the due requests
+// of a round run at once on nonblocking sockets. Backends that fail
+// 'health_fails' probes in a row are down until the next success.
+// Backends of records with 'status_ttl' are probed at least that often
+// and their real status responses are kept for portals. Records with
+// 'aggregate' get the sum of their backend statuses after every round.
+// Portals see the backends through an immutable view published after
+// every round, threads take a new one at their quiescent points.
+class health_checker final {
+public:
+	typedef std::chrono::steady_clock clock;
+	typedef std::shared_ptr<const status_cache::frame_t> status_t;
+	enum class state_t {
+		unknown, up, down
+	};
+	// Players part of a status response
+	struct players_t {
+		long online = 0, max = 0;
+		// Name and id of every player in the sample
+		std::vector<std::pair<std::string, std::string>> sample;
+	};
+	struct backend_health {
+		std::string address;
+		std::uint16_t port = 0;
+		state_t state = state_t::unknown;
+		unsigned fails = 0;
+		std::chrono::milliseconds latency { 0 };
+		clock::time_point checked;
+		std::string error;
+		// Serialized response of the last successful probe
+		status_t status;
+		clock::time_point status_time;
+		players_t players;
+	};
+	// Backends as portals see them
+	struct view_t {
+		struct backend_t {
+			std::string address;
+			std::uint16_t port;
+			bool down;
+			status_t status;
+			clock::time_point status_time;
+		};
+		unsigned long revision = 0;
+		// Sorted by port and address
+		std::vector<backend_t> backends;
+		const backend_t * find(const std::string & address, std::uint16_t port) const noexcept;
+	};
+	typedef std::shared_ptr<const aggregate_status> aggregate_t;
+	static constexpr std::size_t sample_limit = 12;
+	// Milliseconds between probes of aggregated records without status_ttl
+	static constexpr unsigned long aggregate_period = 1000;
+private:
+	struct target {
+		std::string address;
+		std::uint16_t port;
+		std::chrono::milliseconds period;
+		// Address may be taken from the DNS cache
+		bool cache;
+	};
+	struct outcome {
+		std::chrono::milliseconds latency { 0 };
+		std::string message;
+		// Empty if the backend answered
+		std::string error;
+	};
+	std::shared_mutex mutex;
+	std::unordered_map<std::string, backend_health> backends;
+	std::unordered_map<std::string, clock::time_point> schedule;
+	unsigned long aggregates_generation = 0;
+	unsigned long revisions = 0;
+	// By record name, so a new configuration is served the old sums
+	// until the next round
+	std::unordered_map<std::string, aggregate_t> aggregates;
+	std::mutex wake_mutex;
+	std::condition_variable wake;
+	bool stopping = false;
+	// New configuration asks for aggregates, run a round right away
+	bool refresh = false;
+	std::thread thread;
+
+	static std::string key_of(const std::string & address, std::uint16_t port);
+	static std::vector<target> collect(const settings & conf);
+	// Status requests to all the targets at once, each one has the whole
+	// timeout for name resolution, connection and response
+	static std::vector<outcome> probe_all(const std::vector<target> & targets,
+		std::chrono::milliseconds timeout, const hosts_db::ttl_t & ttl, hosts_db::mailbox & box);
+	void apply(const target & t, const outcome & result, const settings & conf);
+	void summarize(const settings & conf);
+	void publish();
+	static const view_t * view();
+	void run();
+public:
+	health_checker() = default;
+	health_checker(const health_checker &) = delete;
+	health_checker & operator=(const health_checker &) = delete;
+	~health_checker();
+	void start();
+	void stop();
+	// Threads that call it see the backends of the last round until the
+	// next call, other threads take the last view on every call
+	static void quiescent();
+	// Only backends that were probed and failed are down
+	bool is_down(const std::string & address, std::uint16_t port);
+	std::vector<backend_health> report();
+	// Real status of the backend if it is not older than max_age
+	status_t live_status(const std::string & address, std::uint16_t port,
+		std::chrono::milliseconds max_age);
+	// Sum of the backend statuses of the record, null if not computed yet
+	aggregate_t aggregate(const std::string & name, unsigned long gen);
+	// Name of the record of a server for aggregate()
+	static std::string record_name(const std::string & server, bool fml);
+	// Reads players from a status response, false if it has no players
+	static bool parse_players(const std::string & message, players_t & result);
+	static aggregate_status merge(const std::vector<const players_t *> & live, unsigned total);
+	// Status request to the backend, returns round trip time or throws
+	static std::chrono::milliseconds check(const std::string & address, std::uint16_t port,
+		std::chrono::milliseconds timeout, std::string * message = nullptr);
+	static health_checker & instance();
+};
+
+const char * to_string(health_checker::state_t state) noexcept;
+
+} // namespace mcshub
+
+#endif // _HEALTH_HEAD
@@ -1,34 +1,158 @@
 #include "hosts_db.hpp"
 
-#include <unordered_map>
-#include <vector>
+#include <functional>
+#include <algorithm>
 
 #include <ekutils/log.hpp>
 
+#include "logging.hpp"
+
 namespace mcshub {
 
-std::unordered_map<std::string, std::vector<ekutils::connection_info>> hosts_db;
+hosts_db::mailbox::mailbox() {
+	set_non_block();
+}
+
+void hosts_db::mailbox::post(completion && result) {
+	{
+		std::lock_guard lock(mutex);
+		answers.push_back(std::move(result));
+	}
+	write(1);
+}
+
+void hosts_db::mailbox::take(std::vector<completion> & result) {
+	read();
+	std::lock_guard lock(mutex);
+	result.swap(answers);
+}
+
+hosts_db::~hosts_db() {
+	{
+		std::lock_guard lock(jobs_mutex);
+		stopping = true;
+	}
+	jobs_cv.notify_all();
+	for (std::thread & thread : threads)
+		thread.join();
+}
+
+std::string hosts_db::key_of(const std::string & host, std::uint16_t port) {
+	return host + ':' + std::to_string(port);
+}
+
+hosts_db::shard & hosts_db::shard_of(const std::string & key) noexcept {
+	return shards[std::hash<std::string>()(key) % shard_count];
+}
+
+void hosts_db::store(const std::string & key, const answer_t & answer, std::chrono::seconds ttl) {
+	if (ttl.count() <= 0)
+		return;
+	shard & s = shard_of(key);
+	std::lock_guard lock(s.mutex);
+	s.entries[key] = { answer, clock::now() + ttl };
+}
+
+bool hosts_db::find(const std::string & host, std::uint16_t port, answer_t & result) {
+	std::string key = key_of(host, port);
+	shard & s = shard_of(key);
+	std::lock_guard lock(s.mutex);
+	auto iter = s.entries.find(key);
+	if (iter == s.entries.end())
+		return false;
+	if (iter->second.expires <= clock::now()) {
+		s.entries.erase(iter);
+		return false;
+	}
+	result = iter->second.answer;
+	return true;
+}
+
+void hosts_db::resolve(const std::string & host, std::uint16_t port, const ttl_t & ttl,
+		mailbox & box, slab_handle client) {
+	std::string key = key_of(host, port);
+	{
+		std::lock_guard lock(jobs_mutex);
+		auto iter = jobs.find(key);
+		if (iter == jobs.end()) {
+			lazy_verbose("new dns request for '" + host + "'");
+			jobs.emplace(key, job { host, port, ttl, { { &box, client } } });
+			queue.push_back(key);
+		} else {
+			iter->second.waiters.push_back({ &box, client });
+			return;
+		}
+		if (!idle && threads.size() < max_threads) {
+			threads.emplace_back([this]() { run(); });
+			idle++;
+		}
+	}
+	jobs_cv.notify_one();
+}
+
+void hosts_db::cancel(mailbox & box) {
+	std::lock_guard lock(jobs_mutex);
+	for (auto & [key, j] : jobs) {
+		auto & waiters = j.waiters;
+		waiters.erase(std::remove_if(waiters.begin(), waiters.end(), [&box](const waiter & w) {
+			return w.box == &box;
+		}), waiters.end());
+	}
+}
+
+std::size_t hosts_db::size() {
+	std::size_t result = 0;
+	for (shard & s : shards) {
+		std::lock_guard lock(s.mutex);
+		result += s.entries.size();
+	}
+	return result;
+}
+
+void hosts_db::clear() {
+	for (shard & s : shards) {
+		std::lock_guard lock(s.mutex);
+		s.entries.clear();
+	}
+}
+
+std::size_t hosts_db::thread_count() {
+	std::lock_guard lock(jobs_mutex);
+	return threads.size();
+}
 
-const std::vector<ekutils::connection_info> & request_dns_cache(
-		const std::string & hostname, std::uint16_t port) {
-	const auto & iter = hosts_db.find(hostname);
-	if (iter == hosts_db.end()) {
-		log_verbose("new dns cache request for '" + hostname + "'");
-		const auto & addresses = hosts_db[hostname] = std::move(ekutils::connection_info::resolve(hostname, port));
-		return addresses;
-	} else {
-		return iter->second;
+void hosts_db::run() {
+	std::unique_lock lock(jobs_mutex);
+	while (true) {
+		jobs_cv.wait(lock, [this]() { return stopping || !queue.empty(); });
+		if (stopping)
+			return;
+		std::string key = std::move(queue.front());
+		queue.pop_front();
+		idle--;
+		std::string host = jobs[key].host;
+		std::uint16_t port = jobs[key].port;
+		lock.unlock();
+		answer_t answer;
+		try {
+			answer = std::make_shared<const addresses>(ekutils::connection_info::resolve(host, port));
+		} catch (const std::exception & e) {
+			lazy_verbose("dns request for '" + host + "' failed: " + e.what());
+		}
+		lock.lock();
+		auto node = jobs.extract(key);
+		job & j = node.mapped();
+		store(key, answer, answer ? j.ttl.positive : j.ttl.negative);
+		// Posting under the lock, so cancel() can't race with it
+		for (waiter & w : j.waiters)
+			w.box->post({ w.client, answer, j.host, j.port });
+		idle++;
 	}
 }
 
-void connect(ekutils::tcp_socket_d & socket, bool cache,
-		const std::string & hostname, std::uint16_t port) {
-	std::size_t l = hostname.length() - 1;
-	std::string name = (hostname[l] == '.') ? hostname.substr(0, l) : hostname;
-	if (cache)
-		socket.open(request_dns_cache(name, port), ekutils::tcp_flags::non_blocking);
-	else
-		socket.open(ekutils::connection_info::resolve(name, port), ekutils::tcp_flags::non_blocking);
+hosts_db & hosts_db::instance() {
+	static hosts_db db;
+	return db;
 }
 
 }
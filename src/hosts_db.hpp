@@ -3,13 +3,116 @@
 
 #include <cinttypes>
 #include <stdexcept>
+#include <memory>
+#include <vector>
+#include <deque>
+#include <array>
+#include <mutex>
+#include <chrono>
+#include <thread>
+#include <condition_variable>
+#include <unordered_map>
 
 #include <ekutils/socket_d.hpp>
+#include <ekutils/event_d.hpp>
+
+#include "slab.hpp"
 
 namespace mcshub {
 
-void connect(ekutils::tcp_socket_d & socket, bool cache,
-    const std::string & hostname, std::uint16_t port);
+// Shared DNS cache with a few resolver threads. Workers never call
+// getaddrinfo(3) themselves: a request parks the connection and the
+// answer comes back through the mailbox of the worker thread. Threads
+// are started on demand, so one slow name doesn't hold the others.
+class hosts_db final {
+public:
+	typedef std::vector<ekutils::connection_info> addresses;
+	// Null answer means that the host name can't be resolved
+	typedef std::shared_ptr<const addresses> answer_t;
+	typedef std::chrono::steady_clock clock;
+
+	struct completion {
+		slab_handle client;
+		answer_t answer;
+		// Requested name, answers for the backend pool are matched by it
+		std::string host;
+		std::uint16_t port = 0;
+	};
+
+	// Answers for one worker thread. Event descriptor becomes readable
+	// when there are new answers.
+	class mailbox final : public ekutils::event_d {
+		std::mutex mutex;
+		std::vector<completion> answers;
+	public:
+		mailbox();
+		void post(completion && result);
+		// Swaps out all the answers received so far
+		void take(std::vector<completion> & result);
+	};
+
+	struct ttl_t {
+		std::chrono::seconds positive;
+		std::chrono::seconds negative;
+	};
+
+private:
+	struct entry {
+		answer_t answer;
+		clock::time_point expires;
+	};
+	struct shard {
+		std::mutex mutex;
+		std::unordered_map<std::string, entry> entries;
+	};
+	static constexpr std::size_t shard_count = 16;
+	std::array<shard, shard_count> shards;
+
+	struct waiter {
+		mailbox * box;
+		slab_handle client;
+	};
+	struct job {
+		std::string host;
+		std::uint16_t port;
+		ttl_t ttl;
+		std::vector<waiter> waiters;
+	};
+	std::mutex jobs_mutex;
+	std::condition_variable jobs_cv;
+	std::deque<std::string> queue;
+	// Requests in flight, also used to merge requests for the same name
+	std::unordered_map<std::string, job> jobs;
+	bool stopping = false;
+	std::vector<std::thread> threads;
+	// Started threads that don't resolve anything right now
+	std::size_t idle = 0;
+
+	static std::string key_of(const std::string & host, std::uint16_t port);
+	shard & shard_of(const std::string & key) noexcept;
+	void store(const std::string & key, const answer_t & answer, std::chrono::seconds ttl);
+	void run();
+public:
+	static constexpr std::size_t max_threads = 4;
+	hosts_db() = default;
+	hosts_db(const hosts_db &) = delete;
+	hosts_db & operator=(const hosts_db &) = delete;
+	~hosts_db();
+
+	// Cached answer without blocking, false if there is no valid entry
+	bool find(const std::string & host, std::uint16_t port, answer_t & result);
+	// Resolve in background and post the answer to the mailbox. Zero
+	// positive TTL disables caching of this request.
+	void resolve(const std::string & host, std::uint16_t port, const ttl_t & ttl,
+		mailbox & box, slab_handle client);
+	// Forget all the requests of the mailbox, nothing is posted to it later
+	void cancel(mailbox & box);
+	std::size_t size();
+	void clear();
+	std::size_t thread_count();
+
+	static hosts_db & instance();
+};
 
 }
 
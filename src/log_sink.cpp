@@ -0,0 +1,240 @@
+#include "log_sink.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <ctime>
+#include <system_error>
+#include <thread>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "logging.hpp"
+
+namespace mcshub {
+
+log_sink::ring::ring(std::size_t capacity) {
+	std::size_t size = 1;
+	while (size < capacity)
+		size <<= 1;
+	entries.resize(size);
+	mask = size - 1;
+}
+
+bool log_sink::ring::push(ekutils::log_level level, const std::string & message) {
+	std::size_t h = head.load(std::memory_order_relaxed);
+	if (h - tail.load(std::memory_order_acquire) >= entries.size()) {
+		drops.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+	entry & e = entries[h & mask];
+	e.level = level;
+	e.time = clock::now();
+	e.message.assign(message);
+	head.store(h + 1, std::memory_order_release);
+	return true;
+}
+
+log_sink::~log_sink() {
+	stop();
+}
+
+log_sink::ring & log_sink::local() {
+	thread_local std::shared_ptr<ring> mine;
+	if (!mine) {
+		mine = std::make_shared<ring>(ring_capacity);
+		std::lock_guard lock(rings_mutex);
+		rings.push_back(mine);
+	}
+	return *mine;
+}
+
+void log_sink::start(const std::string & path) {
+	std::lock_guard lock(wake_mutex);
+	if (thread.joinable())
+		return;
+	fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if (fd == -1)
+		throw std::system_error(errno, std::system_category(), "can't open log file '" + path + "'");
+	stopping = false;
+	running.store(true, std::memory_order_release);
+	thread = std::thread([this]() { run(); });
+}
+
+void log_sink::stop() {
+	// Lines from now on go to the ekutils log
+	running.store(false);
+	{
+		// Lines that passed the check are written by the last drain, new
+		// rings are registered before their producers check the state
+		std::lock_guard lock(rings_mutex);
+		for (const auto & r : rings)
+			while (r->busy())
+				std::this_thread::yield();
+	}
+	{
+		std::lock_guard lock(wake_mutex);
+		stopping = true;
+	}
+	wake.notify_all();
+	if (thread.joinable())
+		thread.join();
+	if (fd != -1) {
+		::close(fd);
+		fd = -1;
+	}
+}
+
+bool log_sink::push(ekutils::log_level level, const std::string & message) {
+	// Threads don't get a ring while the sink is not running
+	if (!running.load(std::memory_order_acquire))
+		return false;
+	ring & r = local();
+	r.enter();
+	if (!running.load()) {
+		r.leave();
+		return false;
+	}
+	// A dropped line is counted, it is still taken by the sink. The
+	// writer picks the line up within the flush period.
+	r.push(level, message);
+	r.leave();
+	return true;
+}
+
+std::uint64_t log_sink::dropped() {
+	std::lock_guard lock(rings_mutex);
+	std::uint64_t result = 0;
+	for (const auto & r : rings)
+		result += r->dropped();
+	return result;
+}
+
+void log_sink::format(std::string & output, const entry & e) {
+	using namespace std::chrono;
+	std::time_t seconds = clock::to_time_t(e.time);
+	std::tm local;
+	localtime_r(&seconds, &local);
+	char stamp[32];
+	std::size_t length = std::strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &local);
+	output.append(stamp, length);
+	int millis = int(duration_cast<milliseconds>(e.time.time_since_epoch()).count() % 1000);
+	length = std::size_t(std::snprintf(stamp, sizeof(stamp), ".%03d [", millis));
+	output.append(stamp, length);
+	output += ekutils::log_lvl2str(e.level);
+	output += "] ";
+	output += e.message;
+	output += '\n';
+}
+
+bool log_sink::collect(std::string & batch) {
+	std::vector<std::shared_ptr<ring>> current;
+	{
+		std::lock_guard lock(rings_mutex);
+		// Rings of finished threads are forgotten when they are empty
+		for (auto iter = rings.begin(); iter != rings.end();) {
+			if (iter->use_count() == 1 && (*iter)->size() == 0)
+				iter = rings.erase(iter);
+			else
+				++iter;
+		}
+		current = rings;
+	}
+	std::uint64_t drops = 0;
+	for (const auto & r : current) {
+		r->drain([&batch](const entry & e) {
+			format(batch, e);
+		});
+		drops += r->dropped();
+	}
+	if (drops > reported_drops) {
+		entry report { ekutils::log_level::warning, clock::now(),
+			std::to_string(drops - reported_drops) + " log messages dropped, log is too slow" };
+		format(batch, report);
+		reported_drops = drops;
+	}
+	return !batch.empty();
+}
+
+void log_sink::write_all(const std::string & batch) noexcept {
+	const char * data = batch.data();
+	std::size_t left = batch.size();
+	while (left) {
+		ssize_t written = ::write(fd, data, left);
+		if (written == -1) {
+			if (errno == EINTR)
+				continue;
+			// Nowhere to report it
+			return;
+		}
+		data += written;
+		left -= std::size_t(written);
+	}
+}
+
+void log_sink::run() {
+	std::string batch;
+	std::unique_lock lock(wake_mutex);
+	while (true) {
+		bool last = stopping;
+		lock.unlock();
+		batch.clear();
+		if (collect(batch))
+			write_all(batch);
+		lock.lock();
+		if (last)
+			break;
+		if (!stopping)
+			wake.wait_for(lock, flush_period);
+	}
+}
+
+log_sink & log_sink::instance() {
+	static log_sink sink;
+	return sink;
+}
+
+namespace {
+
+void log_fallback(ekutils::log_level level, const std::string & message) {
+	switch (level) {
+		case ekutils::log_level::fatal:
+			log_fatal(message);
+			break;
+		case ekutils::log_level::error:
+			log_error(message);
+			break;
+		case ekutils::log_level::warning:
+			log_warning(message);
+			break;
+		case ekutils::log_level::info:
+			log_info(message);
+			break;
+		case ekutils::log_level::verbose:
+			log_verbose(message);
+			break;
+		case ekutils::log_level::debug:
+			log_debug(message);
+			break;
+		default:
+			break;
+	}
+}
+
+} // namespace
+
+void log_line(ekutils::log_level level, const std::string & message) {
+	if (!log_sink::instance().push(level, message))
+		log_fallback(level, message);
+}
+
+void log_line(ekutils::log_level level, const std::exception & e) {
+	if (log_sink::instance().push(level, e.what()))
+		return;
+	if (level == ekutils::log_level::error)
+		log_error(e);
+	else
+		log_fallback(level, e.what());
+}
+
+} // namespace mcshub
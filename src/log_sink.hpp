@@ -0,0 +1,116 @@
+#ifndef _LOG_SINK_HEAD
+#define _LOG_SINK_HEAD
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <ekutils/log.hpp>
+
+namespace mcshub {
+
+// Asynchronous writer of the log file. Every thread that logs gets its
+// own bounded single producer ring, a dedicated thread drains them and
+// writes lines in batches every flush period. Producers never wait and
+// never wake the writer: a line that doesn't fit in the ring is dropped
+// and counted.
+class log_sink final {
+public:
+	typedef std::chrono::system_clock clock;
+	struct entry {
+		ekutils::log_level level;
+		clock::time_point time;
+		// Keeps its capacity, so producers stop allocating after a while
+		std::string message;
+	};
+	class ring final {
+		alignas(64) std::atomic<std::size_t> head { 0 };
+		// Producer is between the check of the sink state and the end of
+		// its push, only stop() reads it
+		std::atomic<bool> pushing { false };
+		alignas(64) std::atomic<std::size_t> tail { 0 };
+		alignas(64) std::atomic<std::uint64_t> drops { 0 };
+		std::vector<entry> entries;
+		std::size_t mask;
+	public:
+		// Capacity is rounded up to a power of two
+		explicit ring(std::size_t capacity);
+		// False if the ring is full
+		bool push(ekutils::log_level level, const std::string & message);
+		// Sequentially consistent with the state of the sink: either the
+		// producer sees the sink stopped or stop() sees it pushing
+		void enter() noexcept {
+			pushing.store(true);
+		}
+		void leave() noexcept {
+			pushing.store(false, std::memory_order_release);
+		}
+		bool busy() const noexcept {
+			return pushing.load();
+		}
+		std::size_t size() const noexcept {
+			return head.load(std::memory_order_acquire) - tail.load(std::memory_order_relaxed);
+		}
+		std::size_t capacity() const noexcept {
+			return entries.size();
+		}
+		std::uint64_t dropped() const noexcept {
+			return drops.load(std::memory_order_relaxed);
+		}
+		// Consumer side, entries stay valid only inside fun
+		template <typename F>
+		std::size_t drain(F fun) {
+			std::size_t first = tail.load(std::memory_order_relaxed);
+			std::size_t last = head.load(std::memory_order_acquire);
+			for (std::size_t i = first; i != last; i++)
+				fun(entries[i & mask]);
+			tail.store(last, std::memory_order_release);
+			return last - first;
+		}
+	};
+
+	static constexpr std::size_t ring_capacity = 4096;
+	static constexpr std::chrono::milliseconds flush_period { 50 };
+private:
+	int fd = -1;
+	std::atomic<bool> running { false };
+	std::mutex rings_mutex;
+	std::vector<std::shared_ptr<ring>> rings;
+	std::mutex wake_mutex;
+	std::condition_variable wake;
+	bool stopping = false;
+	std::thread thread;
+	std::uint64_t reported_drops = 0;
+
+	ring & local();
+	bool collect(std::string & batch);
+	void write_all(const std::string & batch) noexcept;
+	void run();
+public:
+	log_sink() = default;
+	log_sink(const log_sink &) = delete;
+	log_sink & operator=(const log_sink &) = delete;
+	~log_sink();
+	// Opens the file for appending and spawns the writer thread
+	void start(const std::string & path);
+	// Writes everything that is left and closes the file
+	void stop();
+	bool active() const noexcept {
+		return running.load(std::memory_order_acquire);
+	}
+	// False if the sink is not running, the line is not taken then
+	bool push(ekutils::log_level level, const std::string & message);
+	// Lines lost because of full rings
+	std::uint64_t dropped();
+	static void format(std::string & output, const entry & e);
+	static log_sink & instance();
+};
+
+} // namespace mcshub
+
+#endif // _LOG_SINK_HEAD
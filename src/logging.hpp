@@ -0,0 +1,44 @@
+#ifndef _LOGGING_HEAD
+#define _LOGGING_HEAD
+
+#include <atomic>
+#include <string>
+#include <exception>
+
+#include <ekutils/log.hpp>
+
+namespace mcshub {
+
+// Copy of the level of the current log. Messages are formatted only if
+// their level passes it, so disabled statements cost a single branch.
+inline std::atomic<ekutils::log_level> log_threshold { ekutils::log_level::debug };
+
+inline bool log_enabled(ekutils::log_level level) noexcept {
+	return level <= log_threshold.load(std::memory_order_relaxed);
+}
+
+// Should be called together with every change of the log level
+inline void set_log_threshold(ekutils::log_level level) noexcept {
+	log_threshold.store(level, std::memory_order_relaxed);
+}
+
+// Goes to the asynchronous log sink if it runs, to the ekutils log otherwise
+void log_line(ekutils::log_level level, const std::string & message);
+void log_line(ekutils::log_level level, const std::exception & e);
+
+} // namespace mcshub
+
+// The message expression is not evaluated when the level is disabled
+#define lazy_log(level, ...) \
+	do { \
+		if (mcshub::log_enabled(level)) \
+			mcshub::log_line(level, __VA_ARGS__); \
+	} while (false)
+#define lazy_fatal(...) lazy_log(ekutils::log_level::fatal, __VA_ARGS__)
+#define lazy_error(...) lazy_log(ekutils::log_level::error, __VA_ARGS__)
+#define lazy_warning(...) lazy_log(ekutils::log_level::warning, __VA_ARGS__)
+#define lazy_info(...) lazy_log(ekutils::log_level::info, __VA_ARGS__)
+#define lazy_verbose(...) lazy_log(ekutils::log_level::verbose, __VA_ARGS__)
+#define lazy_debug(...) lazy_log(ekutils::log_level::debug, __VA_ARGS__)
+
+#endif // _LOGGING_HEAD
@@ -6,6 +6,9 @@
 #include <ekutils/signal_d.hpp>
 
 #include "settings.hpp"
+#include "client.hpp"
+#include "health.hpp"
+#include "record_stats.hpp"
 
 namespace mcshub {
 
@@ -115,6 +118,38 @@ manager::manager() {
 	root.action("ping", [](auto &) {
 		std::cerr << "pong" << std::endl;
 	}, "print pong");
+	root.action("io", [](auto &) {
+		std::cerr << "receive events: " << gate::receive_events << std::endl;
+		std::cerr << "read calls: " << gate::read_calls << std::endl;
+		std::cerr << "extra reads: " << gate::extra_reads() << std::endl;
+		std::cerr << "throttled gates: " << gate::throttled_gates << std::endl;
+		std::cerr << "throttle events: " << gate::throttle_events << std::endl;
+		std::cerr << "spliced bytes: " << gate::spliced_bytes << std::endl;
+		std::cerr << "ring tunnels: " << portal::ring_tunnels << std::endl;
+		std::cerr << "handshake states: " << portal::handshake_states << std::endl;
+	}, "print tunnel i/o counters");
+	root.action("health", [](auto &) {
+		auto backends = health_checker::instance().report();
+		if (backends.empty())
+			std::cerr << "no health information, see 'health_interval' option" << std::endl;
+		for (auto & health : backends) {
+			std::cerr << health.address << ':' << health.port << ' ' << to_string(health.state);
+			if (health.state == health_checker::state_t::up)
+				std::cerr << ' ' << health.latency.count() << " ms";
+			if (!health.error.empty())
+				std::cerr << " (" << health.error << ", fails: " << health.fails << ')';
+			std::cerr << std::endl;
+		}
+	}, "print health of backend servers");
+	root.word("stats", "server")->action([](auto & forms) {
+		const auto & name = form_as_word(forms, "server");
+		record_stats::summary record;
+		if (!record_stats::collect(*conf_snap(), name, record)) {
+			std::cerr << "no statistics for server \"" << name << "\" ($default is the default record)" << std::endl;
+			return;
+		}
+		std::cerr << record_stats::describe(record);
+	}, "print statistics of a server record");
 }
 
 void manager::on_line() {
@@ -1,14 +1,19 @@
 #include "mcshub.hpp"
 
 #include <iostream>
+#include <memory>
 
 #include <ekutils/signal_d.hpp>
 
 #include "thread_controller.hpp"
+#include "health.hpp"
 #include "manager.hpp"
 #include "prog_args.hpp"
 #include "settings.hpp"
 #include "config.hpp"
+#include "logging.hpp"
+#include "log_sink.hpp"
+#include "metrics_server.hpp"
 
 namespace mcshub {
 
@@ -61,35 +66,43 @@ Options:
 	ekutils::stdout_log l(ekutils::log_level::debug);
 	ekutils::log = &l;
 	settings::initialize();
-	log_info("switch log depends configuration");
+	lazy_info("switch log depends configuration");
 	std::shared_ptr<const settings> c = conf;
-	if ((const std::string &)(c->log) == "$std")
-		ekutils::log->set_log_level(c->verb);
-	else
-		ekutils::log = new ekutils::file_log(c->log, c->verb);
+	ekutils::log->set_log_level(c->verb);
+	if ((const std::string &)(c->log) != "$std") {
+		// Lines are written by a separate thread, workers never wait for the file
+		log_sink::instance().start(c->log);
+	}
+	set_log_threshold(c->verb);
 	using ekutils::sig;
 	ekutils::signal_d signal { sig::abort, sig::broken_pipe, sig::termination, sig::segmentation_fail };
 	ekutils::epoll_d poll;
 	settings::init_listener(poll);
-	log_verbose("current version -- " + config::build);
+	std::unique_ptr<metrics_server> scrapes;
+	if (c->metrics_port)
+		scrapes = std::make_unique<metrics_server>(poll, c->metrics_address, c->metrics_port);
+	lazy_verbose("current version -- " + config::build);
 	thread_controller controller;
-	log_verbose("start server on " + c->address + ':' + std::to_string(thread_controller::real_port));
+	health_checker::instance().start();
+	lazy_verbose("start server on " + c->address + ':' + std::to_string(thread_controller::real_port));
 	c.reset();
 	poll.add(signal, [&signal, &controller](auto &, std::uint32_t) {
 		switch (signal.read()) {
 			case sig::abort:
-				log_fatal("abort signal received, a part of the MCSHub was destroyed");
+				lazy_fatal("abort signal received, a part of the MCSHub was destroyed");
 				return;
 			case sig::segmentation_fail:
 				// Very bad...
-				log_fatal("segmentation fail");
+				lazy_fatal("segmentation fail");
 				return;
 			case sig::broken_pipe:
 				return;
 			case sig::termination:
-				log_info("terminating MCSHub instance...");
+				lazy_info("terminating MCSHub instance...");
+				health_checker::instance().stop();
 				controller.terminate();
-				log_info("successfuly stoped MCSHub");
+				lazy_info("successfuly stoped MCSHub");
+				log_sink::instance().stop();
 				std::exit(EXIT_SUCCESS);
 				return;
 			default:
@@ -0,0 +1,170 @@
+#include "metrics.hpp"
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+namespace mcshub {
+
+namespace {
+
+std::mutex shards_mutex;
+std::vector<std::unique_ptr<metrics::shard>> shards;
+
+struct counter_info {
+	metrics::counter_t counter;
+	const char * name;
+	const char * labels;
+};
+
+// Counters with the same name form one family with different labels
+const counter_info counter_names[] = {
+	{ metrics::counter_t::accepts, "mcshub_accepted_connections_total", "" },
+	{ metrics::counter_t::closes, "mcshub_closed_connections_total", "" },
+	{ metrics::counter_t::status_handshakes, "mcshub_handshakes_total", "state=\"status\"" },
+	{ metrics::counter_t::login_handshakes, "mcshub_handshakes_total", "state=\"login\"" },
+	{ metrics::counter_t::status_fake, "mcshub_status_responses_total", "source=\"fake\"" },
+	{ metrics::counter_t::status_cached, "mcshub_status_responses_total", "source=\"cache\"" },
+	{ metrics::counter_t::status_aggregate, "mcshub_status_responses_total", "source=\"aggregate\"" },
+	{ metrics::counter_t::status_proxied, "mcshub_status_responses_total", "source=\"backend\"" },
+	{ metrics::counter_t::logins_fake, "mcshub_logins_total", "result=\"fake\"" },
+	{ metrics::counter_t::logins_proxied, "mcshub_logins_total", "result=\"backend\"" },
+	{ metrics::counter_t::connect_failures, "mcshub_backend_connect_failures_total", "" },
+	{ metrics::counter_t::connect_timeouts, "mcshub_timeouts_total", "kind=\"connect\"" },
+	{ metrics::counter_t::handshake_timeouts, "mcshub_timeouts_total", "kind=\"handshake\"" },
+	{ metrics::counter_t::idle_timeouts, "mcshub_timeouts_total", "kind=\"idle\"" },
+	{ metrics::counter_t::bytes_upstream, "mcshub_proxied_bytes_total", "direction=\"upstream\"" },
+	{ metrics::counter_t::bytes_downstream, "mcshub_proxied_bytes_total", "direction=\"downstream\"" },
+};
+
+static_assert(std::size(counter_names) == metrics::counters, "every counter needs a name");
+
+const char * histogram_names[] = {
+	"mcshub_backend_latency_seconds"
+};
+
+static_assert(std::size(histogram_names) == metrics::histograms, "every histogram needs a name");
+
+std::string seconds(std::uint64_t micros) {
+	std::string result = std::to_string(micros / 1000000);
+	std::string fraction = std::to_string(micros % 1000000);
+	fraction.insert(0, 6 - fraction.size(), '0');
+	while (!fraction.empty() && fraction.back() == '0')
+		fraction.pop_back();
+	if (!fraction.empty())
+		result += '.' + fraction;
+	return result;
+}
+
+} // namespace
+
+void metrics::latency::observe(std::chrono::microseconds value) noexcept {
+	std::uint64_t micros = value.count() < 0 ? 0 : std::uint64_t(value.count());
+	std::size_t bucket = std::size_t(std::lower_bound(bounds.begin(), bounds.end(), micros) - bounds.begin());
+	bump(cells[bucket], 1);
+	bump(cells[bounds.size() + 1], micros);
+	bump(cells[bounds.size() + 2], 1);
+}
+
+void metrics::latency::collect(histogram & result) const noexcept {
+	for (std::size_t b = 0; b <= bounds.size(); b++)
+		result.buckets[b] += cells[b].load(std::memory_order_relaxed);
+	result.sum += cells[bounds.size() + 1].load(std::memory_order_relaxed);
+	result.count += cells[bounds.size() + 2].load(std::memory_order_relaxed);
+}
+
+double metrics::quantile(const histogram & hist, double q) noexcept {
+	std::uint64_t total = 0;
+	for (std::uint64_t n : hist.buckets)
+		total += n;
+	if (!total)
+		return 0;
+	double rank = q * double(total), seen = 0;
+	for (std::size_t b = 0; b < hist.buckets.size(); b++) {
+		std::uint64_t n = hist.buckets[b];
+		if (n && seen + double(n) >= rank) {
+			// Values above the last bound are reported as the last bound
+			if (b == bounds.size())
+				return double(bounds.back());
+			double lower = b ? double(bounds[b - 1]) : 0, upper = double(bounds[b]);
+			return lower + (upper - lower) * (rank - seen) / double(n);
+		}
+		seen += double(n);
+	}
+	return double(bounds.back());
+}
+
+void metrics::shard::collect(snapshot & result) const noexcept {
+	for (std::size_t i = 0; i < counters; i++)
+		result.values[i] += values[i].load(std::memory_order_relaxed);
+	for (std::size_t h = 0; h < histograms; h++)
+		latencies[h].collect(result.latencies[h]);
+}
+
+metrics::shard & metrics::local() {
+	thread_local shard * mine = nullptr;
+	if (!mine) {
+		auto fresh = std::make_unique<shard>();
+		mine = fresh.get();
+		std::lock_guard lock(shards_mutex);
+		shards.push_back(std::move(fresh));
+	}
+	return *mine;
+}
+
+metrics::snapshot metrics::collect() {
+	snapshot result;
+	std::lock_guard lock(shards_mutex);
+	for (const auto & s : shards)
+		s->collect(result);
+	return result;
+}
+
+std::string metrics::render(const snapshot & data) {
+	std::string result;
+	const char * family = "";
+	for (const auto & info : counter_names) {
+		if (std::string_view(family) != info.name) {
+			family = info.name;
+			result += "# TYPE ";
+			result += family;
+			result += " counter\n";
+		}
+		result += info.name;
+		if (*info.labels) {
+			result += '{';
+			result += info.labels;
+			result += '}';
+		}
+		result += ' ' + std::to_string(data[info.counter]) + '\n';
+	}
+	// Both counters of a connection are written by one thread
+	std::uint64_t accepted = data[counter_t::accepts], closed = data[counter_t::closes];
+	result += "# TYPE mcshub_active_connections gauge\nmcshub_active_connections "
+		+ std::to_string(accepted > closed ? accepted - closed : 0) + '\n';
+	for (std::size_t h = 0; h < histograms; h++) {
+		const std::string name = histogram_names[h];
+		result += "# TYPE " + name + " histogram\n";
+		render(result, name, "", data.latencies[h]);
+	}
+	return result;
+}
+
+void metrics::render(std::string & output, const std::string & name, const std::string & labels,
+		const histogram & hist) {
+	const std::string prefix = labels.empty() ? "{" : '{' + labels + ',';
+	const std::string suffix = labels.empty() ? "" : '{' + labels + '}';
+	std::uint64_t cumulative = 0;
+	for (std::size_t b = 0; b < bounds.size(); b++) {
+		cumulative += hist.buckets[b];
+		output += name + "_bucket" + prefix + "le=\"" + seconds(bounds[b]) + "\"} " + std::to_string(cumulative) + '\n';
+	}
+	cumulative += hist.buckets[bounds.size()];
+	output += name + "_bucket" + prefix + "le=\"+Inf\"} " + std::to_string(cumulative) + '\n';
+	output += name + "_sum" + suffix + ' ' + seconds(hist.sum) + '\n';
+	output += name + "_count" + suffix + ' ' + std::to_string(hist.count) + '\n';
+}
+
+} // namespace mcshub
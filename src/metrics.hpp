@@ -0,0 +1,93 @@
+#ifndef _METRICS_HEAD
+#define _METRICS_HEAD
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace mcshub {
+
+// Counters and histograms of the hub. Every thread has its own shard
+// aligned to a cache line and written only by that thread, so updates
+// are plain relaxed stores without locks or shared cache lines. Scrapes
+// sum the shards of all threads, shards of finished threads are kept.
+class metrics final {
+public:
+	enum class counter_t : unsigned {
+		accepts, closes,
+		status_handshakes, login_handshakes,
+		status_fake, status_cached, status_aggregate, status_proxied,
+		logins_fake, logins_proxied,
+		connect_failures,
+		connect_timeouts, handshake_timeouts, idle_timeouts,
+		bytes_upstream, bytes_downstream,
+		count
+	};
+	enum class histogram_t : unsigned {
+		// From the handshake of a client to the established backend connection
+		backend_latency,
+		count
+	};
+	static constexpr std::size_t counters = std::size_t(counter_t::count);
+	static constexpr std::size_t histograms = std::size_t(histogram_t::count);
+	// Upper bounds of histogram buckets in microseconds
+	static constexpr std::array<std::uint64_t, 12> bounds {
+		1000, 2000, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000, 2500000, 5000000
+	};
+
+	struct histogram {
+		// The last bucket counts values above all the bounds
+		std::array<std::uint64_t, bounds.size() + 1> buckets {};
+		std::uint64_t sum = 0;
+		std::uint64_t count = 0;
+	};
+	struct snapshot {
+		std::array<std::uint64_t, counters> values {};
+		std::array<histogram, histograms> latencies {};
+		std::uint64_t operator[](counter_t c) const noexcept {
+			return values[std::size_t(c)];
+		}
+	};
+
+	typedef std::atomic<std::uint64_t> cell;
+	static void bump(cell & c, std::uint64_t n) noexcept {
+		// Only the owner thread writes the cell
+		c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+	}
+	// Histogram cells that are written by one thread
+	class latency final {
+		std::array<cell, bounds.size() + 3> cells {};
+	public:
+		void observe(std::chrono::microseconds value) noexcept;
+		void collect(histogram & result) const noexcept;
+	};
+	// Estimated from the buckets, in microseconds
+	static double quantile(const histogram & hist, double q) noexcept;
+
+	class alignas(64) shard final {
+		std::array<cell, counters> values {};
+		std::array<latency, histograms> latencies;
+	public:
+		void add(counter_t c, std::uint64_t n = 1) noexcept {
+			bump(values[std::size_t(c)], n);
+		}
+		void observe(histogram_t h, std::chrono::microseconds value) noexcept {
+			latencies[std::size_t(h)].observe(value);
+		}
+		void collect(snapshot & result) const noexcept;
+	};
+
+	static shard & local();
+	static snapshot collect();
+	// Prometheus text exposition format
+	static std::string render(const snapshot & data);
+	// Bucket, sum and count lines of one histogram without the TYPE line
+	static void render(std::string & output, const std::string & name, const std::string & labels,
+		const histogram & hist);
+};
+
+} // namespace mcshub
+
+#endif // _METRICS_HEAD
@@ -0,0 +1,110 @@
+#include "metrics_server.hpp"
+
+#include "metrics.hpp"
+#include "client.hpp"
+#include "record_stats.hpp"
+#include "settings.hpp"
+#include "logging.hpp"
+
+namespace mcshub {
+
+metrics_server::metrics_server(ekutils::epoll_d & p, const std::string & address, std::uint16_t port) : poll(p) {
+	listener.listen(address, port);
+	listener.start();
+	poll.add(listener, [this](ekutils::descriptor &, std::uint32_t) {
+		on_accept();
+	});
+	lazy_verbose("metrics are served on " + address + ':' + std::to_string(this->port()));
+}
+
+metrics_server::~metrics_server() {
+	for (auto & conn : connections)
+		poll.remove(conn.sock);
+	poll.remove(listener);
+}
+
+std::uint16_t metrics_server::port() const {
+	return listener.local_endpoint().port();
+}
+
+void metrics_server::on_accept() {
+	try {
+		connections.emplace_front(listener.accept());
+		conn_iter conn = connections.begin();
+		conn->sock.set_non_block();
+		using namespace ekutils::actions;
+		poll.add(conn->sock, in | out | et | err | rdhup, [this, conn](ekutils::descriptor &, std::uint32_t events) {
+			on_event(conn, events);
+		});
+	} catch (const std::exception & e) {
+		lazy_warning("metrics connection failed");
+		lazy_warning(e);
+	}
+}
+
+void metrics_server::on_event(conn_iter conn, std::uint32_t events) {
+	using namespace ekutils;
+	if (events & actions::err)
+		return close(conn);
+	if (conn->response.empty() && (events & (actions::in | actions::rdhup))) {
+		char chunk[1024];
+		while (true) {
+			int got = conn->sock.read(reinterpret_cast<byte_t *>(chunk), sizeof(chunk));
+			if (got < 0)
+				break;
+			if (got == 0)
+				return close(conn);
+			conn->request.append(chunk, std::size_t(got));
+			if (conn->request.size() > max_request)
+				return close(conn);
+		}
+		if (conn->request.find("\r\n\r\n") == std::string::npos) {
+			if (events & actions::rdhup)
+				close(conn);
+			return;
+		}
+		conn->response = respond(conn->request);
+	}
+	if (!conn->response.empty() && flush(*conn))
+		close(conn);
+}
+
+bool metrics_server::flush(connection & conn) {
+	while (conn.sent < conn.response.size()) {
+		int written = conn.sock.write(reinterpret_cast<const byte_t *>(conn.response.data()) + conn.sent,
+			conn.response.size() - conn.sent);
+		if (written <= 0)
+			return false;
+		conn.sent += std::size_t(written);
+	}
+	return true;
+}
+
+void metrics_server::close(conn_iter conn) {
+	// Destroys the handler that is running now, nothing is touched after it
+	poll.remove(conn->sock);
+	connections.erase(conn);
+}
+
+std::string metrics_server::respond(std::string_view request) {
+	std::string_view status = "200 OK";
+	std::string body;
+	if (request.substr(0, 13) == "GET /metrics " || request.substr(0, 14) == "HEAD /metrics ") {
+		body = metrics::render(metrics::collect());
+		body += "# TYPE mcshub_throttled_tunnels gauge\nmcshub_throttled_tunnels "
+			+ std::to_string(gate::throttled_gates.load(std::memory_order_relaxed)) + '\n';
+		body += record_stats::render(record_stats::collect(*conf_snap()));
+	} else {
+		status = "404 Not Found";
+		body = "Not Found\n";
+	}
+	std::string result = "HTTP/1.1 ";
+	result += status;
+	result += "\r\nContent-Type: text/plain; version=0.0.4; charset=utf-8\r\nContent-Length: "
+		+ std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n";
+	if (request.substr(0, 5) != "HEAD ")
+		result += body;
+	return result;
+}
+
+} // namespace mcshub
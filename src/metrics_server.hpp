@@ -0,0 +1,45 @@
+#ifndef _METRICS_SERVER_HEAD
+#define _METRICS_SERVER_HEAD
+
+#include <list>
+#include <string>
+#include <string_view>
+
+#include <ekutils/epoll_d.hpp>
+#include <ekutils/socket_d.hpp>
+
+namespace mcshub {
+
+// Minimal HTTP/1.1 listener for Prometheus scrapes. Lives on the main
+// epoll, every request gets one response and the connection is closed.
+class metrics_server final {
+	struct connection {
+		ekutils::tcp_socket_d sock;
+		std::string request;
+		std::string response;
+		std::size_t sent = 0;
+		explicit connection(ekutils::tcp_socket_d && socket) : sock(std::move(socket)) {}
+	};
+	typedef std::list<connection>::iterator conn_iter;
+	ekutils::epoll_d & poll;
+	ekutils::tcp_listener_d listener;
+	std::list<connection> connections;
+	void on_accept();
+	void on_event(conn_iter conn, std::uint32_t events);
+	// Returns true when the whole response is written
+	bool flush(connection & conn);
+	void close(conn_iter conn);
+public:
+	static constexpr std::size_t max_request = 8192;
+	metrics_server(ekutils::epoll_d & poll, const std::string & address, std::uint16_t port);
+	metrics_server(const metrics_server &) = delete;
+	metrics_server & operator=(const metrics_server &) = delete;
+	~metrics_server();
+	std::uint16_t port() const;
+	// Whole HTTP response for the request head
+	static std::string respond(std::string_view request);
+};
+
+} // namespace mcshub
+
+#endif // _METRICS_SERVER_HEAD
@@ -0,0 +1,20 @@
+#include "record_route.hpp"
+
+#include <cassert>
+
+namespace mcshub {
+
+record_route route_record(const route_table<settings::server_record> & routes,
+		const settings::server_record & default_server, std::string_view address, std::string & server_name) {
+	auto route = routes.find(address);
+	// Tables are built before the settings are published
+	assert(route.record);
+	server_name = route.name;
+	const settings::server_record & r = *route.record;
+	// Unknown names share the default record, they are not counted one by one
+	const std::string & name = &r == &default_server ? record_stats::default_name : server_name;
+	bool fml = route.fml && r.fml;
+	return { fml ? *r.fml : r, record_stats::local(name), name, fml };
+}
+
+} // namespace mcshub
@@ -0,0 +1,30 @@
+#ifndef _RECORD_ROUTE_HEAD
+#define _RECORD_ROUTE_HEAD
+
+#include <string>
+#include <string_view>
+
+#include "settings.hpp"
+#include "record_stats.hpp"
+
+namespace mcshub {
+
+// Record that serves a handshake address with its statistics slot.
+// Every handshake does this lookup once in portal::record().
+struct record_route {
+	const settings::basic_record & record;
+	record_stats::slot & stats;
+	// Name of the statistics slot, the same in every configuration
+	const std::string & stats_name;
+	// FML record of the server is used
+	bool fml;
+};
+
+// Normalized server name is stored to server_name, stats_name of the
+// result may refer to it
+record_route route_record(const route_table<settings::server_record> & routes,
+	const settings::server_record & default_server, std::string_view address, std::string & server_name);
+
+} // namespace mcshub
+
+#endif // _RECORD_ROUTE_HEAD
@@ -0,0 +1,160 @@
+#include "record_stats.hpp"
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <unordered_map>
+
+#include "settings.hpp"
+
+namespace mcshub {
+
+const std::string record_stats::default_name = "$default";
+
+namespace {
+
+std::mutex slots_mutex;
+// Slots of all the threads by record name, never freed
+std::map<std::string, std::vector<std::unique_ptr<record_stats::slot>>> slots;
+
+struct counter_info {
+	record_stats::counter_t counter;
+	const char * name;
+	const char * labels;
+};
+
+const counter_info counter_names[] = {
+	{ record_stats::counter_t::tunnels_opened, "mcshub_record_tunnels_total", "" },
+	{ record_stats::counter_t::tunnels_closed, "mcshub_record_closed_tunnels_total", "" },
+	{ record_stats::counter_t::status_requests, "mcshub_record_handshakes_total", ",state=\"status\"" },
+	{ record_stats::counter_t::login_attempts, "mcshub_record_handshakes_total", ",state=\"login\"" },
+	{ record_stats::counter_t::fake_logins, "mcshub_record_fake_logins_total", "" },
+	{ record_stats::counter_t::bytes_in, "mcshub_record_proxied_bytes_total", ",direction=\"upstream\"" },
+	{ record_stats::counter_t::bytes_out, "mcshub_record_proxied_bytes_total", ",direction=\"downstream\"" },
+};
+
+static_assert(std::size(counter_names) == record_stats::counters, "every counter needs a name");
+
+std::string label(const std::string & name) {
+	std::string result = "record=\"";
+	for (char c : name) {
+		switch (c) {
+			case '\\':
+				result += "\\\\";
+				break;
+			case '"':
+				result += "\\\"";
+				break;
+			case '\n':
+				result += "\\n";
+				break;
+			default:
+				result += c;
+		}
+	}
+	result += '"';
+	return result;
+}
+
+bool configured(const settings & conf, const std::string & name) {
+	return name == record_stats::default_name || conf.servers.find(name) != conf.servers.end();
+}
+
+std::string millis(double micros) {
+	return std::to_string(int(micros / 1000 + 0.5)) + " ms";
+}
+
+} // namespace
+
+void record_stats::slot::collect(summary & result) const noexcept {
+	for (std::size_t i = 0; i < counters; i++)
+		result.values[i] += values[i].load(std::memory_order_relaxed);
+	latency.collect(result.latency);
+}
+
+record_stats::slot & record_stats::local(const std::string & name) {
+	thread_local std::unordered_map<std::string, slot *> mine;
+	auto iter = mine.find(name);
+	if (iter != mine.end())
+		return *iter->second;
+	auto fresh = std::make_unique<slot>();
+	slot & result = *fresh;
+	{
+		std::lock_guard lock(slots_mutex);
+		slots[name].push_back(std::move(fresh));
+	}
+	mine.emplace(name, &result);
+	return result;
+}
+
+std::vector<record_stats::summary> record_stats::collect(const settings & conf) {
+	std::vector<summary> result;
+	std::lock_guard lock(slots_mutex);
+	result.reserve(slots.size());
+	for (const auto & [name, threads] : slots) {
+		if (!configured(conf, name))
+			continue;
+		summary & record = result.emplace_back();
+		record.name = name;
+		for (const auto & s : threads)
+			s->collect(record);
+	}
+	return result;
+}
+
+bool record_stats::collect(const settings & conf, const std::string & name, summary & result) {
+	std::lock_guard lock(slots_mutex);
+	auto iter = slots.find(name);
+	if (iter == slots.end() || !configured(conf, name))
+		return false;
+	result.name = name;
+	for (const auto & s : iter->second)
+		s->collect(result);
+	return true;
+}
+
+std::string record_stats::render(const std::vector<summary> & records) {
+	std::string result;
+	if (records.empty())
+		return result;
+	const char * family = "";
+	for (const auto & info : counter_names) {
+		if (std::string_view(family) != info.name) {
+			family = info.name;
+			result += "# TYPE ";
+			result += family;
+			result += " counter\n";
+		}
+		for (const auto & record : records)
+			result += info.name + ('{' + label(record.name)) + info.labels + "} " + std::to_string(record[info.counter]) + '\n';
+	}
+	result += "# TYPE mcshub_record_active_tunnels gauge\n";
+	for (const auto & record : records)
+		result += "mcshub_record_active_tunnels{" + label(record.name) + "} " + std::to_string(record.active()) + '\n';
+	result += "# TYPE mcshub_record_backend_latency_seconds histogram\n";
+	for (const auto & record : records)
+		metrics::render(result, "mcshub_record_backend_latency_seconds", label(record.name), record.latency);
+	return result;
+}
+
+std::string record_stats::describe(const summary & record) {
+	std::string result;
+	result += "active tunnels: " + std::to_string(record.active()) + '\n';
+	result += "tunnels: " + std::to_string(record[counter_t::tunnels_opened]) + '\n';
+	result += "status requests: " + std::to_string(record[counter_t::status_requests]) + '\n';
+	result += "login attempts: " + std::to_string(record[counter_t::login_attempts]) + '\n';
+	result += "fake logins: " + std::to_string(record[counter_t::fake_logins]) + '\n';
+	result += "bytes in: " + std::to_string(record[counter_t::bytes_in]) + '\n';
+	result += "bytes out: " + std::to_string(record[counter_t::bytes_out]) + '\n';
+	if (record.latency.count) {
+		result += "connect latency: p50 " + millis(metrics::quantile(record.latency, 0.5))
+			+ ", p90 " + millis(metrics::quantile(record.latency, 0.9))
+			+ ", p99 " + millis(metrics::quantile(record.latency, 0.99)) + '\n';
+	} else {
+		result += "connect latency: no connections\n";
+	}
+	return result;
+}
+
+} // namespace mcshub
@@ -0,0 +1,68 @@
+#ifndef _RECORD_STATS_HEAD
+#define _RECORD_STATS_HEAD
+
+#include <array>
+#include <string>
+#include <vector>
+
+#include "metrics.hpp"
+
+namespace mcshub {
+
+struct settings;
+
+// Statistics of every server record. They are kept by the record name,
+// so they survive configuration reloads. Like metrics, every thread
+// writes only its own slot of a record, a slot is found once per client.
+class record_stats final {
+public:
+	enum class counter_t : unsigned {
+		tunnels_opened, tunnels_closed,
+		status_requests, login_attempts, fake_logins,
+		bytes_in, bytes_out,
+		count
+	};
+	static constexpr std::size_t counters = std::size_t(counter_t::count);
+	// Name of the record for unknown server names
+	static const std::string default_name;
+
+	struct summary {
+		std::string name;
+		std::array<std::uint64_t, counters> values {};
+		// From the handshake to the established backend connection
+		metrics::histogram latency {};
+		std::uint64_t operator[](counter_t c) const noexcept {
+			return values[std::size_t(c)];
+		}
+		std::uint64_t active() const noexcept {
+			std::uint64_t opened = (*this)[counter_t::tunnels_opened], closed = (*this)[counter_t::tunnels_closed];
+			return opened > closed ? opened - closed : 0;
+		}
+	};
+
+	class alignas(64) slot final {
+		std::array<metrics::cell, counters> values {};
+		metrics::latency latency;
+	public:
+		void add(counter_t c, std::uint64_t n = 1) noexcept {
+			metrics::bump(values[std::size_t(c)], n);
+		}
+		void observe(std::chrono::microseconds value) noexcept {
+			latency.observe(value);
+		}
+		void collect(summary & result) const noexcept;
+	};
+
+	static slot & local(const std::string & name);
+	// Sorted by name, records removed from the configuration are skipped
+	static std::vector<summary> collect(const settings & conf);
+	static bool collect(const settings & conf, const std::string & name, summary & result);
+	// Prometheus text exposition format with a 'record' label
+	static std::string render(const std::vector<summary> & records);
+	// Human readable form for the CLI
+	static std::string describe(const summary & record);
+};
+
+} // namespace mcshub
+
+#endif // _RECORD_STATS_HEAD
@@ -4,8 +4,11 @@
 #include <fstream>
 #include <cassert>
 
+#include <cstring>
+
 #include <ekutils/uuid.hpp>
 #include <ekutils/log.hpp>
+#include <ekutils/parse_essentials.hpp>
 
 namespace mcshub {
 
@@ -106,6 +109,23 @@ std::string server_vars::operator[](const std::string & name) const {
 		return iter->second;
 }
 
+std::string agg_vars::operator[](const std::string & name) const {
+	aggregate_status empty;
+	const aggregate_status & agg = status ? *status : empty;
+	if (name == "online")
+		return std::to_string(agg.online);
+	else if (name == "max")
+		return std::to_string(agg.max);
+	else if (name == "sample")
+		return agg.sample;
+	else if (name == "live")
+		return std::to_string(agg.live);
+	else if (name == "total")
+		return std::to_string(agg.total);
+	else
+		return nothing;
+}
+
 std::string main_vars_t::operator[](const std::string & name) const {
 	if (name == "uuid") {
 		return ekutils::uuid::random();
@@ -115,4 +135,100 @@ std::string main_vars_t::operator[](const std::string & name) const {
 
 main_vars_t main_vars;
 
+static bool isvar(char c) {
+	return std::isalnum(static_cast<unsigned char>(c)) || c == ':' || c == '_';
+}
+
+compiled_template::compiled_template(const char * str, std::size_t length,
+		const char * const namespaces[], std::size_t count) {
+	text.reserve(length);
+	std::size_t i, j;
+	for (i = 0, j = 0; i < length;) {
+		if (str[i] == '$') {
+			char next = i + 1 < length ? str[i + 1] : '\0';
+			if (!isvar(next) && next != '{' && next != '$') {
+				i += 1;
+				continue;
+			}
+			add_literal(str + j, i - j);
+			i++;
+			switch (str[i]) {
+				case '$': {
+					add_literal("$", 1);
+					i++;
+					j = i;
+					break;
+				}
+				case '{': {
+					int t = ekutils::find_closing_bracket<'{'>(str + i);
+					add_var(str + i + 1, t - 2, namespaces, count);
+					i += t;
+					j = i;
+					break;
+				}
+				default: {
+					std::size_t t;
+					for (t = 0; i + t < length && isvar(str[i + t]); t++);
+					add_var(str + i, t, namespaces, count);
+					i += t;
+					j = i;
+				}
+			}
+		} else
+			i++;
+	}
+	if (i != j)
+		add_literal(str + j, i - j);
+}
+
+void compiled_template::add_literal(const char * str, std::size_t length) {
+	if (length == 0)
+		return;
+	if (!parts.empty() && parts.back().ns == literal && parts.back().offset + parts.back().length == text.size()) {
+		// Join with previous literal
+		parts.back().length += length;
+	} else {
+		parts.push_back({ literal, text.size(), length, std::string() });
+	}
+	text.append(str, length);
+	literal_size += length;
+}
+
+void compiled_template::add_var(const char * str, std::size_t length,
+		const char * const namespaces[], std::size_t count) {
+	ekutils::trim_string(str, length);
+	int d = ekutils::find_char<':'>(str, length);
+	if (d < 0) {
+		parts.push_back({ 0, 0, 0, std::string(str, length) });
+		return;
+	}
+	std::size_t ns_len = d;
+	ekutils::trim_string(str, ns_len);
+	const char * name_raw = str + d + 1;
+	std::size_t name_raw_len = length - d - 1;
+	ekutils::trim_string(name_raw, name_raw_len);
+	int ns = no_namespace;
+	for (std::size_t k = 0; k < count; k++) {
+		if (std::strlen(namespaces[k]) == ns_len && !std::strncmp(namespaces[k], str, ns_len)) {
+			ns = int(k);
+			break;
+		}
+	}
+	parts.push_back({ ns, 0, 0, std::string(name_raw, name_raw_len) });
+}
+
+bool compiled_template::uses(int ns) const noexcept {
+	for (const auto & part : parts)
+		if (part.ns == ns)
+			return true;
+	return false;
+}
+
+bool compiled_template::uses(int ns, const std::string & name) const noexcept {
+	for (const auto & part : parts)
+		if (part.ns == ns && part.name == name)
+			return true;
+	return false;
+}
+
 }
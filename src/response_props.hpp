@@ -7,6 +7,7 @@
 #include <variant>
 #include <array>
 #include <functional>
+#include <type_traits>
 
 #include <ekutils/parse_essentials.hpp>
 
@@ -40,122 +41,135 @@ struct server_vars final {
 	std::string operator[](const std::string & name) const;
 };
 
+// Sum of the cached statuses of several backends
+struct aggregate_status final {
+	long online = 0, max = 0;
+	// Backends with a fresh status and all the backends
+	unsigned live = 0, total = 0;
+	// JSON array of players
+	std::string sample = "[]";
+	unsigned long revision = 0;
+};
+
+struct agg_vars final {
+	static constexpr const char * name = "agg";
+	const aggregate_status * status = nullptr;
+	std::string operator[](const std::string & name) const;
+};
+
 struct main_vars_t final {
 	static constexpr const char * name = "main";
 	std::string operator[](const std::string & name) const;
 };
 extern main_vars_t main_vars;
 
-template <typename ...vars_t>
-class vars_manager final : public std::tuple<const vars_t &...> {
-	struct string_cut {
-		const char * chunk;
-		unsigned size;
+// Template parsed into literal spans and variable slots. Namespace of
+// every slot is bound to an index in the vars_manager at compile time.
+class compiled_template final {
+public:
+	static constexpr int literal = -1;
+	static constexpr int no_namespace = -2;
+	struct part {
+		// literal or namespace index
+		int ns;
+		std::size_t offset, length;
+		std::string name;
 	};
-	template <typename first, typename ...others>
-	static std::string find_in_next(const std::string & ns, const std::string & name, const first & var, const others &... vars) {
-		if (first::name == ns)
-			return var[name];
-		else
-			return find_in_next(ns, name, vars...);
+private:
+	std::string text;
+	std::vector<part> parts;
+	std::size_t literal_size = 0;
+	void add_literal(const char * str, std::size_t length);
+	void add_var(const char * str, std::size_t length, const char * const namespaces[], std::size_t count);
+public:
+	compiled_template() = default;
+	compiled_template(const char * str, std::size_t length, const char * const namespaces[], std::size_t count);
+	const std::vector<part> & slots() const noexcept {
+		return parts;
 	}
-	template <typename first>
-	static std::string find_in_next(const std::string & ns, const std::string & name, const first & var) {
-		if (first::name == ns)
-			return var[name];
-		else
+	const char * chunk(const part & p) const noexcept {
+		return text.data() + p.offset;
+	}
+	std::size_t literals_size() const noexcept {
+		return literal_size;
+	}
+	bool uses(int ns) const noexcept;
+	bool uses(int ns, const std::string & name) const noexcept;
+};
+
+template <typename ...vars_t>
+class vars_manager final : public std::tuple<const vars_t &...> {
+	static constexpr const char * namespaces[] = { vars_t::name... };
+	template <std::size_t I = 0>
+	std::string lookup(int ns, const std::string & name) const {
+		if constexpr (I < sizeof...(vars_t)) {
+			if (ns == int(I))
+				return std::get<I>((const std::tuple<const vars_t &...> &)*this)[name];
+			return lookup<I + 1>(ns, name);
+		} else {
 			return "{ NO NSPA }";
+		}
 	}
-	static bool isvar(char c) {
-		return std::isalnum(c) || c == ':' || c == '_';
+	template <typename V, std::size_t I, typename first, typename ...others>
+	static constexpr int index_in() noexcept {
+		if constexpr (std::is_same_v<V, first>)
+			return int(I);
+		else if constexpr (sizeof...(others) == 0)
+			return compiled_template::no_namespace;
+		else
+			return index_in<V, I + 1, others...>();
 	}
 public:
 	explicit vars_manager(const vars_t &... vars) : std::tuple<const vars_t &...>(vars...) {}
 
-	inline std::string resolve(const std::string & content) const {
-		return resolve(content.c_str(), content.size());
+	template <typename V>
+	static constexpr int ns_index() noexcept {
+		return index_in<V, 0, vars_t...>();
+	}
+
+	static compiled_template compile(const char * str, std::size_t length) {
+		return compiled_template(str, length, namespaces, sizeof...(vars_t));
+	}
+	static compiled_template compile(const std::string & content) {
+		return compile(content.c_str(), content.size());
 	}
 	template <std::size_t N>
-	std::string resolve(const std::array<std::uint8_t, N> & content) const {
-		return resolve(reinterpret_cast<const char *>(content.data()), content.size());
+	static compiled_template compile(const std::array<std::uint8_t, N> & content) {
+		return compile(reinterpret_cast<const char *>(content.data()), content.size());
 	}
-	std::string resolve(const char *str, std::size_t length) const {
-		std::vector<std::variant<string_cut, std::string>> result;
-		std::size_t i, j;
-		for (i = 0, j = 0; i < length;) {
-			if (str[i] == '$') {
-				if (!isvar(str[i + 1]) && str[i + 1] != '{' && str[i + 1] != '$') {
-					i += 1;
-					continue;
-				}
-				result.emplace_back(string_cut { str + j, static_cast<unsigned>(i - j) });
-				i++;
-				switch (str[i]) {
-					case '$': {
-						result.emplace_back(string_cut { "$", 1 });
-						i++;
-						j = i;
-						break;
-					}
-					case '{': {
-						int t = ekutils::find_closing_bracket<'{'>(str + i);
-						std::string value = get_value(str + i + 1, t - 2);
-						result.push_back(std::move(value));
-						i += t;
-						j = i;
-						break;
-					}
-					default: {
-						std::size_t t;
-						for (t = 0; isvar(str[i + t]); t++);
-						std::string value = get_value(str + i, t);
-						result.push_back(std::move(value));
-						i += t;
-						j = i;
-					}
-				}
-			} else
-				i++;
+
+	std::string render(const compiled_template & tmpl) const {
+		const auto & parts = tmpl.slots();
+		std::vector<std::string> values;
+		values.reserve(parts.size());
+		std::size_t size = tmpl.literals_size();
+		for (const auto & part : parts) {
+			if (part.ns != compiled_template::literal) {
+				values.push_back(lookup(part.ns, part.name));
+				size += values.back().size();
+			}
 		}
-		if (i != j)
-			result.emplace_back(string_cut { str + j, static_cast<unsigned>(i - j) });
-		std::size_t size = 0;
-		for (auto & str : result) {
-			if (std::holds_alternative<std::string>(str))
-				size += std::get<std::string>(str).size();
+		std::string result;
+		result.reserve(size);
+		auto value = values.begin();
+		for (const auto & part : parts) {
+			if (part.ns == compiled_template::literal)
+				result.append(tmpl.chunk(part), part.length);
 			else
-				size += std::get<string_cut>(str).size;
+				result += *(value++);
 		}
-		std::string result_string;
-		result_string.reserve(size);
-		for (auto & str : result) {
-			if (std::holds_alternative<std::string>(str))
-				result_string += std::get<std::string>(str);
-			else {
-				const string_cut & cut = std::get<string_cut>(str);
-				result_string.append(cut.chunk, cut.size);
-			}
-		}
-		return result_string;
+		return result;
 	}
 
-	std::string get_value(const char * str, std::size_t length) const {
-		ekutils::trim_string(str, length);
-		int d = ekutils::find_char<':'>(str, length);
-		if (d < 0) {
-			return std::get<0>((const std::tuple<const vars_t &...> &)*this)[std::string(str, length)];
-		}
-		std::size_t ns_len = d;
-		ekutils::trim_string(str, ns_len);
-		std::string ns = std::string(str, ns_len);
-		const char * name_raw = str + d + 1;
-		std::size_t name_raw_len = length - d - 1;
-		ekutils::trim_string(name_raw, name_raw_len);
-		std::string name = std::string(name_raw, name_raw_len);
-		auto find_value = [&ns, &name](auto const &... e) -> std::string {
-			return find_in_next(ns, name, e...);
-		};
-		return std::apply(find_value, (const std::tuple<const vars_t &...> &) *this);
+	inline std::string resolve(const std::string & content) const {
+		return render(compile(content));
+	}
+	template <std::size_t N>
+	std::string resolve(const std::array<std::uint8_t, N> & content) const {
+		return render(compile(content));
+	}
+	std::string resolve(const char *str, std::size_t length) const {
+		return render(compile(str, length));
 	}
 };
 
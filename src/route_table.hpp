@@ -0,0 +1,105 @@
+#ifndef _ROUTE_TABLE_HEAD
+#define _ROUTE_TABLE_HEAD
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <functional>
+
+namespace mcshub {
+
+// Immutable hostname lookup table compiled from the configured records.
+// It is a flat open addressing table over record names, and handshake
+// addresses are normalized in place without allocations. The table
+// refers to keys and values of the source map, so it has to be rebuilt
+// whenever the map changes and it can't be copied. A moved table keeps
+// referring to the records of the moved map.
+template <typename Record>
+class route_table {
+	struct slot {
+		std::size_t hash = 0;
+		std::string_view name;
+		const Record * record = nullptr;
+	};
+	std::vector<slot> slots;
+	std::size_t mask = 0;
+	std::string domain;
+	const Record * fallback = nullptr;
+
+	static std::size_t hash_of(std::string_view name) noexcept {
+		return std::hash<std::string_view>()(name);
+	}
+public:
+	struct match {
+		// Default record if the name is unknown
+		const Record * record;
+		std::string_view name;
+		bool fml;
+	};
+
+	route_table() = default;
+	route_table(const route_table &) = delete;
+	route_table(route_table && other) = default;
+	route_table & operator=(const route_table &) = delete;
+	route_table & operator=(route_table && other) = default;
+
+	template <typename Map>
+	void build(const Map & records, const Record & default_record, const std::string & suffix) {
+		clear();
+		domain = suffix;
+		fallback = &default_record;
+		std::size_t capacity = 4;
+		while (capacity < records.size() * 2)
+			capacity *= 2;
+		slots.assign(capacity, slot {});
+		mask = capacity - 1;
+		for (const auto & [name, record] : records) {
+			std::string_view key = name;
+			std::size_t hash = hash_of(key);
+			std::size_t i = hash & mask;
+			while (slots[i].record)
+				i = (i + 1) & mask;
+			slots[i] = { hash, key, &record };
+		}
+	}
+	void clear() noexcept {
+		slots.clear();
+		mask = 0;
+		domain.clear();
+		fallback = nullptr;
+	}
+	bool empty() const noexcept {
+		return fallback == nullptr;
+	}
+	// Strips FML marker, trailing dot and domain suffix
+	std::string_view normalize(std::string_view address, bool & fml) const noexcept {
+		std::size_t end = address.find('\0');
+		fml = end != std::string_view::npos;
+		std::string_view name = address.substr(0, end);
+		if (!name.empty() && name.back() == '.')
+			name.remove_suffix(1);
+		std::size_t domain_sz = domain.size();
+		if (name.size() > domain_sz && !name.compare(name.size() - domain_sz, domain_sz, domain))
+			name.remove_suffix(domain_sz);
+		return name;
+	}
+	match find(std::string_view address) const noexcept {
+		match result { fallback, {}, false };
+		result.name = normalize(address, result.fml);
+		if (slots.empty())
+			return result;
+		std::size_t hash = hash_of(result.name);
+		for (std::size_t i = hash & mask; slots[i].record; i = (i + 1) & mask) {
+			const slot & s = slots[i];
+			if (s.hash == hash && s.name == result.name) {
+				result.record = s.record;
+				break;
+			}
+		}
+		return result;
+	}
+};
+
+} // namespace mcshub
+
+#endif // _ROUTE_TABLE_HEAD
@@ -1,17 +1,40 @@
 #include "sclient.hpp"
 
+#include <stdexcept>
+#include <system_error>
+
+#include <sys/socket.h>
+
 namespace mcshub {
 
+void sclient::set_timeout(std::chrono::milliseconds timeout) {
+    timeval tv;
+    tv.tv_sec = timeout.count() / 1000;
+    tv.tv_usec = (timeout.count() % 1000) * 1000;
+    int fd = sock.get_handle();
+    if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) == -1 ||
+            setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) == -1)
+        throw std::system_error(errno, std::generic_category(), "socket timeout");
+}
+
 void sclient::read(std::size_t length) {
     in_buff.asize(length);
     auto ptr = in_buff.data() + in_buff.size() - length;
-    for (std::size_t received = 0; received < length;
-        received += sock.read(ptr + received, length - received));
+    for (std::size_t received = 0; received < length;) {
+        int r = sock.read(ptr + received, length - received);
+        if (r <= 0)
+            throw std::runtime_error(r ? "server response timed out" : "server closed connection");
+        received += r;
+    }
 }
 
 void sclient::write(const ekutils::byte_t data[], std::size_t length) {
-    for (std::size_t received = 0; received < length;
-        received += sock.write(data + received, length - received));
+    for (std::size_t sent = 0; sent < length;) {
+        int r = sock.write(data + sent, length - sent);
+        if (r <= 0)
+            throw std::runtime_error("server request timed out");
+        sent += r;
+    }
 }
 
 void sclient::peek_head(std::size_t & size, std::int32_t & id) {
@@ -24,15 +47,21 @@ void sclient::peek_head(std::size_t & size, std::int32_t & id) {
     size = static_cast<std::size_t>(actual) + sz;
 }
 
-pakets::response sclient::status(const std::string & name, std::uint16_t port) {
+std::vector<ekutils::byte_t> sclient::status_request(const std::string & name, std::uint16_t port) {
     pakets::handshake hs;
     hs.version() = -1;
     hs.address() = name;
     hs.port() = port;
     hs.state() = 1;
-    write_paket(hs);
-    pakets::request req;
-    write_paket(req);
+    std::vector<ekutils::byte_t> result;
+    append_paket(result, hs);
+    append_paket(result, pakets::request());
+    return result;
+}
+
+pakets::response sclient::status(const std::string & name, std::uint16_t port) {
+    auto request = status_request(name, port);
+    write(request.data(), request.size());
     pakets::response res;
     read_paket(res);
     return res;
@@ -3,6 +3,8 @@
 
 #include <cassert>
 #include <chrono>
+#include <vector>
+#include <stdexcept>
 
 #include <ekutils/socket_d.hpp>
 #include <ekutils/putil.hpp>
@@ -27,32 +29,51 @@ public:
 		conns(ekutils::connection_info::resolve(host, service)), sock(conns) {}
 	sclient(const std::string & host, std::uint16_t port = 25565) :
 		conns(ekutils::connection_info::resolve(host, port)), sock(conns) {}
+	// Takes a connected socket, reconnect() is not available then
+	explicit sclient(ekutils::tcp_socket_d && connected) : sock(std::move(connected)) {}
+	// Limits every blocking read and write, expired operation throws
+	void set_timeout(std::chrono::milliseconds timeout);
 	void peek_head(std::size_t & size, std::int32_t & id);
+	// Reads the first packet of the bytes, returns its size or 0 if it is
+	// not complete yet. Packets that don't match their header are thrown.
 	template <typename P>
-	void read_paket(P & paket) {
+	static std::size_t parse_paket(const ekutils::byte_t data[], std::size_t length, P & paket) {
+		std::int32_t size, id;
+		int actual = handtruth::pakets::head(data, length, size, id);
+		if (actual == -1 || length < std::size_t(actual) + std::size_t(size))
+			return 0;
+		std::size_t total = std::size_t(actual) + std::size_t(size);
+		int received = paket.read(data, total);
+		if (received < 0 || std::size_t(received) != total)
+			throw std::runtime_error("malformed packet from server");
+		return total;
+	}
+	template <typename P>
+	static void append_paket(std::vector<ekutils::byte_t> & output, const P & paket) {
 		using namespace handtruth::pakets;
-		using namespace ekutils;
+		std::size_t size = paket.size();
+		size = size + size_varint(paket.id()) + size_varint(size);
+		std::size_t old = output.size();
+		output.resize(old + size);
+		int written = paket.write(output.data() + old, size);
+		assert(std::size_t(written) == size);
+	}
+	// Handshake and request that start a status exchange
+	static std::vector<ekutils::byte_t> status_request(const std::string & name, std::uint16_t port);
+	template <typename P>
+	void read_paket(P & paket) {
 		std::size_t size;
 		std::int32_t id;
 		peek_head(size, id);
 		read(size - in_buff.size());
-		int received = paket.read(in_buff.data(), size);
-		assert(std::size_t(received) == size);
+		parse_paket(in_buff.data(), size, paket);
 		in_buff.move(size);
 	}
 	template <typename P>
 	void write_paket(const P & paket) {
-		using namespace handtruth::pakets;
-		using namespace ekutils;
-		std::size_t size = paket.size();
-		size = size + size_varint(paket.id()) + size_varint(size);
-		auto data = new byte_t[size];
-		finnaly({
-			delete[] data;
-		});
-		int written = paket.write(data, size);
-		assert(std::size_t(written) == size);
-		write(data, size);
+		std::vector<ekutils::byte_t> data;
+		append_paket(data, paket);
+		write(data.data(), data.size());
 	}
 	void reconnect() {
 		sock.open(conns);
@@ -4,6 +4,7 @@
 #include <filesystem>
 #include <unordered_set>
 #include <algorithm>
+#include <atomic>
 #include <sys/sysinfo.h>
 
 #include <yaml-cpp/yaml.h>
@@ -13,6 +14,7 @@
 
 #include "resources.hpp"
 #include "prog_args.hpp"
+#include "logging.hpp"
 
 namespace fs = std::filesystem;
 
@@ -60,6 +62,20 @@ struct srv_dir_wt : public watch_data {
 	} 
 } srv_dir;
 
+// Files of a server directory that change the published configuration
+bool server_file(const std::string & name) {
+	return name == arguments.status || name == arguments.login || name == arguments.confname;
+}
+
+bool watched_file(const std::string & file) {
+	fs::path path = fs::path(file).lexically_normal();
+	if (path.is_absolute() || !server_file(path.filename()))
+		return false;
+	// Server directories are right in the configuration directory
+	fs::path dir = path.parent_path();
+	return !dir.empty() && dir != ".." && dir.parent_path().empty();
+}
+
 inline settings::server_record conf_record_mcsman(const std::string & name) {
 	const std::string domain = name + "-mcs";
 	return {
@@ -74,6 +90,57 @@ settings::basic_record default_record;
 ekutils::matomic<std::shared_ptr<const settings>> conf_instance;
 const ekutils::matomic<std::shared_ptr<const settings>> & conf = conf_instance;
 
+std::atomic<unsigned long> published_generation = 0;
+
+void settings::build_routes() {
+	auto table = std::make_shared<routes_t>();
+	table->build(servers, default_server, domain);
+	routes = std::move(table);
+}
+
+void publish(const std::shared_ptr<settings> & c) {
+	static std::atomic<unsigned long> generations = 0;
+	c->generation = ++generations;
+	c->build_routes();
+	conf_instance = c;
+	published_generation.store(c->generation, std::memory_order_release);
+}
+
+thread_local std::shared_ptr<const settings> local_conf;
+thread_local bool conf_registered = false;
+
+inline void refresh_local_conf() {
+	unsigned long generation = published_generation.load(std::memory_order_acquire);
+	if (!local_conf || local_conf->generation != generation)
+		local_conf = conf;
+}
+
+conf_reader::conf_reader() {
+	conf_registered = true;
+	refresh_local_conf();
+}
+
+conf_reader::~conf_reader() {
+	conf_registered = false;
+	local_conf.reset();
+}
+
+void conf_reader::quiescent() {
+	refresh_local_conf();
+}
+
+const settings & conf_reader::get() {
+	if (!conf_registered)
+		refresh_local_conf();
+	return *local_conf;
+}
+
+std::shared_ptr<const settings> conf_reader::snapshot() {
+	if (conf_registered)
+		return local_conf;
+	return conf;
+}
+
 void load_all_conf(const std::shared_ptr<settings> & c, bool add_watch = false) {
 	c->load(arguments.confname);
 	// load configurations for all sub directories
@@ -83,18 +150,20 @@ void load_all_conf(const std::shared_ptr<settings> & c, bool add_watch = false)
 			std::string name = file.path().filename();
 			if (arguments.mcsman && name != "default") {
 				// load mcsman settings first
-				log_info("init mcsman configuration for \"" + name + "\"");
+				lazy_info("init mcsman configuration for \"" + name + "\"");
 				servers[name] = conf_record_mcsman(name);
 			}
 			if (add_watch) {
 				using namespace ekutils::inev;
-				fs_watcher.add_watch(create | moved_to | delete_self | move_self, file.path(), &srv_dir);
+				// close_write makes status and login files changes visible too,
+				// changes of other files are skipped by the listener
+				fs_watcher.add_watch(create | moved_to | close_write | delete_self | move_self, file.path(), &srv_dir);
 			}
 			fs::path conf_f = file.path()/arguments.confname;
 			if (fs::exists(conf_f) && fs::is_regular_file(conf_f)) {
 				// load sub conf
 				if (c->distributed) {
-					log_info("init distributed configuration for \"" + name + "\"");
+					lazy_info("init distributed configuration for \"" + name + "\"");
 					auto node = YAML::LoadFile(conf_f);
 					auto iter = servers.find(name);
 					if (iter != servers.end()) {
@@ -117,7 +186,7 @@ void load_all_conf(const std::shared_ptr<settings> & c, bool add_watch = false)
 void reload_configuration() {
 	auto new_conf = std::make_shared<settings>(default_conf);
 	load_all_conf(new_conf);
-	conf_instance = new_conf;
+	publish(new_conf);
 }
 
 void settings::initialize() {
@@ -144,7 +213,23 @@ void settings::initialize() {
 			{}, // vars
 		},
 		{}, // servers
-		!arguments.no_dns_cache // dns_cache
+		!arguments.no_dns_cache, // dns_cache
+		60, // dns_ttl
+		5, // dns_negative_ttl
+		0, // health_interval
+		1000, // health_timeout
+		2, // health_fails
+		true, // splice
+		1048576, // high_watermark
+		262144, // low_watermark
+		settings::io_backend_t::epoll, // io_backend
+		1024, // uring_buffers
+		10000, // handshake_timeout
+		0, // idle_timeout
+		"127.0.0.1", // metrics_address
+		0, // metrics_port
+		0, // generation
+		nullptr // routes
 	};
 	default_record = {
 		std::string(), //address
@@ -153,14 +238,19 @@ void settings::initialize() {
 		"", // login
 		false, // drop
 		false, // mcsman
-		{} //vars
+		{}, //vars
+		{}, // pool
+		{}, // upstreams
+		settings::balance_t::round_robin, // balance
+		0, // status_ttl
+		false // aggregate
 	};
 	using namespace ekutils::inev;
 	fs_watcher.add_watch(close_write | delete_self | move_self, arguments.confname, &main_conf);
 	fs_watcher.add_watch(create | moved_to | in_delete, cdir, &main_dir);
 	auto c = std::make_shared<settings>(default_conf);
 	load_all_conf(c, true);
-	conf_instance = c;
+	publish(c);
 }
 
 void settings::init_listener(ekutils::epoll_d & poll) {
@@ -168,9 +258,15 @@ void settings::init_listener(ekutils::epoll_d & poll) {
 		std::vector<ekutils::inotify_d::event_t> events = fs_watcher.read();
 		std::shared_ptr<const settings> old_conf = conf;
 		std::shared_ptr<settings> new_conf = std::make_shared<settings>(*old_conf);
+		bool changed = false;
 		for (auto iter = events.rbegin(); iter != events.rend(); iter++) {
 			using ekutils::inev::inev_t;
 			auto event = *iter;
+			if (event.watch.data == &srv_dir && !(event.mask & inev_t::delete_self || event.mask & inev_t::move_self)
+					&& !server_file(event.subject))
+				// Nothing reads other files of server directories on reload
+				continue;
+			changed = true;
 			// 1: main_conf { close_write, delete_self | move_self }
 			// 2: main_dir { create | moved_to (srv_dir, main_conf), delete | moved_from }
 			// 3: srv_conf { delete_self | move_self, close_write }
@@ -184,14 +280,14 @@ void settings::init_listener(ekutils::epoll_d & poll) {
 						new_conf = std::make_shared<settings>(default_conf);
 						load_all_conf(new_conf);
 					} catch (const YAML::Exception & yaml_e) {
-						log_error("main configuration file has problems");
-						log_error(yaml_e);
+						lazy_error("main configuration file has problems");
+						lazy_error(yaml_e);
 					}
-					log_info("reloaded main configuration");
+					lazy_info("reloaded main configuration");
 				}
 				if (event.mask & inev_t::delete_self || event.mask & inev_t::move_self) {
 					// main conf: delete_self
-					log_error("main settings file was deleted");
+					lazy_error("main settings file was deleted");
 					fs_watcher.remove_watch(event.watch);
 				}
 			} else if (event.watch.data == &main_dir) {
@@ -203,11 +299,11 @@ void settings::init_listener(ekutils::epoll_d & poll) {
 						// create | moved_to (srv_dir)
 						if (arguments.mcsman && name != "default") {
 							// add mcsman auto-record
-							log_info("added new mcsman server configuration \"" + name + "\"");
+							lazy_info("added new mcsman server configuration \"" + name + "\"");
 							new_conf->servers[name] = conf_record_mcsman(name);
 						}
 						using namespace ekutils::inev;
-						fs_watcher.add_watch(delete_self | move_self | create | moved_to, cdir/name, &srv_dir);
+						fs_watcher.add_watch(delete_self | move_self | create | moved_to | close_write, cdir/name, &srv_dir);
 					}
 					if (name == arguments.confname) {
 						// create | moved_to (main_conf)
@@ -215,12 +311,12 @@ void settings::init_listener(ekutils::epoll_d & poll) {
 							auto node = YAML::LoadFile(arguments.confname);
 							node >> *new_conf;
 						} catch (const YAML::Exception & yaml_e) {
-							log_error("main configuration file \"" + name + "\" has problems");
-							log_error(yaml_e);
+							lazy_error("main configuration file \"" + name + "\" has problems");
+							lazy_error(yaml_e);
 						}
 						using namespace ekutils::inev;
 						fs_watcher.add_watch(delete_self | move_self | close_write, arguments.confname, &main_conf);
-						log_info("main configuration created again after destroying");
+						lazy_info("main configuration created again after destroying");
 					}
 				}
 				if (event.mask & inev_t::in_delete || event.mask & inev_t::moved_from) {
@@ -233,10 +329,10 @@ void settings::init_listener(ekutils::epoll_d & poll) {
 					// srv_conf: delete_self | move_self
 					new_conf->servers.erase(name);
 					if (old_conf->distributed) {
-						log_verbose("conf for \"" + name + "\" was deleted");
+						lazy_verbose("conf for \"" + name + "\" was deleted");
 						if (arguments.mcsman && name != "default") {
 							new_conf->servers[name] = conf_record_mcsman(name);
-							log_verbose("but mcsman conf for \"" + name + "\" was recreated");
+							lazy_verbose("but mcsman conf for \"" + name + "\" was recreated");
 						}
 					}
 					fs_watcher.remove_watch(event.watch);
@@ -254,10 +350,10 @@ void settings::init_listener(ekutils::epoll_d & poll) {
 							node >> record;
 							servers[name] = record;
 						}
-						log_verbose("reload conf for \"" + name + "\"");
+						lazy_verbose("reload conf for \"" + name + "\"");
 					} catch (const YAML::Exception & yaml_e) {
-						log_error("configuration file for server \"" + name + "\" has problems");
-						log_error(yaml_e);
+						lazy_error("configuration file for server \"" + name + "\" has problems");
+						lazy_error(yaml_e);
 					}
 				}
 			} else if (event.watch.data == &srv_dir) {
@@ -282,11 +378,11 @@ void settings::init_listener(ekutils::epoll_d & poll) {
 									servers[name] = record;
 								}
 							} catch (const YAML::Exception & yaml_e) {
-								log_error("configuration file \"" + std::string(conf_file) +
+								lazy_error("configuration file \"" + std::string(conf_file) +
 									"\" for server \"" + name + "\" has problems");
-								log_error(yaml_e);
+								lazy_error(yaml_e);
 							}
-							log_verbose("created configuration for \"" + name + "\"");
+							lazy_verbose("created configuration for \"" + name + "\"");
 						}
 						using namespace ekutils::inev;
 						fs_watcher.add_watch(delete_self | move_self | close_write, conf_file, &srv_conf);
@@ -297,14 +393,15 @@ void settings::init_listener(ekutils::epoll_d & poll) {
 					if (arguments.mcsman) {
 						// erase mcsman conf if persists
 						std::string name = event.watch.path().filename();
-						log_info("mcsman configuration for \"" + name + "\" was deleted");
+						lazy_info("mcsman configuration for \"" + name + "\" was deleted");
 						new_conf->servers.erase(name);
 					}
 					fs_watcher.remove_watch(event.watch);
 				}
 			}
 		}
-		conf_instance = new_conf;
+		if (changed)
+			publish(new_conf);
 	});
 }
 
@@ -348,6 +445,55 @@ void fill_record(const YAML::Node & node, settings::basic_record & record) {
 	for (auto item : node["vars"]) {
 		record.vars[item.first.as<std::string>()] = item.second.as<std::string>();
 	}
+	if (auto pool = node["pool"]) {
+		if (!pool.IsMap())
+			throw config_exception("record.pool", "not a map yaml structure");
+		if (auto min_idle = pool["min_idle"])
+			record.pool.min_idle = min_idle.as<unsigned>();
+		if (auto max_idle = pool["max_idle"])
+			record.pool.max_idle = max_idle.as<unsigned>();
+		if (auto max_age = pool["max_age"])
+			record.pool.max_age = max_age.as<unsigned long>();
+		if (record.pool.min_idle > record.pool.max_idle)
+			record.pool.max_idle = record.pool.min_idle;
+	}
+	if (auto upstreams = node["upstreams"]) {
+		if (!upstreams.IsSequence())
+			throw config_exception("record.upstreams", "not a list yaml structure");
+		record.upstreams.clear();
+		unsigned total = 0;
+		for (auto item : upstreams) {
+			settings::upstream_t & upstream = record.upstreams.emplace_back();
+			if (auto address = item["address"])
+				upstream.address = address.as<std::string>();
+			else
+				throw config_exception("record.upstreams", "upstream without address");
+			if (auto port = item["port"])
+				upstream.port = port.as<std::uint16_t>();
+			else
+				upstream.port = record.port;
+			if (auto weight = item["weight"])
+				upstream.weight = weight.as<unsigned>();
+			total += upstream.weight;
+		}
+		if (!record.upstreams.empty() && !total)
+			throw config_exception("record.upstreams", "all upstreams have zero weight");
+	}
+	if (auto balance = node["balance"]) {
+		const std::string policy = balance.as<std::string>();
+		if (policy == "round_robin")
+			record.balance = settings::balance_t::round_robin;
+		else if (policy == "least_conn")
+			record.balance = settings::balance_t::least_conn;
+		else if (policy == "hash")
+			record.balance = settings::balance_t::hash;
+		else
+			throw config_exception("record.balance", "no '" + policy + "' balance policy");
+	}
+	if (auto status_ttl = node["status_ttl"])
+		record.status_ttl = status_ttl.as<unsigned long>();
+	if (auto aggregate = node["aggregate"])
+		record.aggregate = aggregate.as<bool>();
 }
 
 void operator>>(const YAML::Node & node, settings::server_record & record) {
@@ -425,6 +571,50 @@ void operator>>(const YAML::Node & node, settings & conf) {
 	}
 	if (auto dns_cache = node["dns_cache"])
 		conf.dns_cache = dns_cache.as<bool>();
+	if (auto dns_ttl = node["dns_ttl"])
+		conf.dns_ttl = dns_ttl.as<unsigned long>();
+	if (auto dns_negative_ttl = node["dns_negative_ttl"])
+		conf.dns_negative_ttl = dns_negative_ttl.as<unsigned long>();
+	if (auto health_interval = node["health_interval"])
+		conf.health_interval = health_interval.as<unsigned long>();
+	if (auto health_timeout = node["health_timeout"])
+		conf.health_timeout = health_timeout.as<unsigned long>();
+	if (auto health_fails = node["health_fails"]) {
+		conf.health_fails = health_fails.as<unsigned>();
+		if (!conf.health_fails)
+			throw config_exception("health_fails", "should be at least 1");
+	}
+	if (auto splice = node["splice"])
+		conf.splice = splice.as<bool>();
+	if (auto high_watermark = node["high_watermark"])
+		conf.high_watermark = high_watermark.as<std::size_t>();
+	if (auto low_watermark = node["low_watermark"])
+		conf.low_watermark = low_watermark.as<std::size_t>();
+	if (auto io_backend = node["io_backend"]) {
+		const std::string backend = io_backend.as<std::string>();
+		if (backend == "epoll")
+			conf.io_backend = settings::io_backend_t::epoll;
+		else if (backend == "uring")
+			conf.io_backend = settings::io_backend_t::uring;
+		else
+			throw config_exception("io_backend", "no '" + backend + "' I/O backend");
+	}
+	if (auto uring_buffers = node["uring_buffers"]) {
+		conf.uring_buffers = uring_buffers.as<unsigned>();
+		unsigned count = conf.uring_buffers;
+		if (!count || count > 32768 || (count & (count - 1)))
+			throw config_exception("uring_buffers", "should be a power of two up to 32768");
+	}
+	if (auto handshake_timeout = node["handshake_timeout"])
+		conf.handshake_timeout = handshake_timeout.as<unsigned long>();
+	if (auto idle_timeout = node["idle_timeout"])
+		conf.idle_timeout = idle_timeout.as<unsigned long>();
+	if (auto metrics_address = node["metrics_address"])
+		conf.metrics_address = metrics_address.as<std::string>();
+	if (auto metrics_port = node["metrics_port"])
+		conf.metrics_port = metrics_port.as<std::uint16_t>();
+	if (conf.high_watermark && conf.low_watermark > conf.high_watermark)
+		throw config_exception("low_watermark", "low watermark is greater than high watermark");
 }
 
 void settings::load(const std::string & path) {
@@ -14,6 +14,8 @@
 #include <ekutils/epoll_d.hpp>
 #include <ekutils/log.hpp>
 
+#include "route_table.hpp"
+
 namespace mcshub {
 
 struct settings {
@@ -30,6 +32,17 @@ struct settings {
 
 	std::string domain;
 
+	struct upstream_t {
+		std::string address;
+		std::uint16_t port = 0;
+		// 0 means that the backend gets no new connections
+		unsigned weight = 1;
+	};
+
+	enum class balance_t {
+		round_robin, least_conn, hash
+	};
+
 	struct basic_record {
 		std::string address;
 		std::uint16_t port = 0;
@@ -41,6 +54,27 @@ struct settings {
 		bool mcsman = false;
 
 		std::unordered_map<std::string, std::string> vars;
+
+		// Established idle backend connections kept by every worker
+		struct pool_t {
+			unsigned min_idle = 0;
+			unsigned max_idle = 0;
+			// Milliseconds, 0 means unlimited
+			unsigned long max_age = 0;
+		} pool;
+
+		// Replace address and port if not empty
+		std::vector<upstream_t> upstreams;
+		balance_t balance = balance_t::round_robin;
+
+		// Milliseconds to serve the real backend status from cache
+		unsigned long status_ttl = 0;
+		// Serve the sum of the backend statuses instead of one of them
+		bool aggregate = false;
+
+		bool has_backend() const noexcept {
+			return !upstreams.empty() || (!address.empty() && port);
+		}
 	};
 
 	struct server_record : public basic_record {
@@ -66,7 +100,7 @@ struct settings {
 		server_record(const std::string & address, std::uint16_t port, const std::string & status,
 			const std::string & login, bool drop, bool mcsman,
 			const std::unordered_map<std::string, std::string> & vars) :
-				basic_record { address, port, status, login, drop, mcsman, vars } {}
+				basic_record { address, port, status, login, drop, mcsman, vars, {}, {}, balance_t::round_robin, 0, false } {}
 		server_record(const server_record & other) :
 				basic_record(other) {
 			copy_fml(other.fml);
@@ -100,6 +134,43 @@ struct settings {
 	std::unordered_map<std::string, server_record> servers;
 
 	bool dns_cache = false;
+	// Seconds to keep resolved and unresolvable backend names
+	unsigned long dns_ttl = 0;
+	unsigned long dns_negative_ttl = 0;
+	// Milliseconds between backend probes, 0 disables health checks
+	unsigned long health_interval = 0;
+	unsigned long health_timeout = 0;
+	// Failed probes in a row to consider a backend down
+	unsigned health_fails = 0;
+	bool splice = false;
+	std::size_t high_watermark = 0;
+	std::size_t low_watermark = 0;
+	enum class io_backend_t {
+		epoll, uring
+	};
+	// Used by workers started afterwards, epoll if io_uring is missing
+	io_backend_t io_backend = io_backend_t::epoll;
+	// Provided receive buffers of every worker ring, a power of two
+	unsigned uring_buffers = 0;
+	// Milliseconds for a new connection to get a tunnel or a fake
+	// response, and milliseconds of silence that close a tunnel.
+	// 0 means no limit.
+	unsigned long handshake_timeout = 0;
+	unsigned long idle_timeout = 0;
+	// Local HTTP listener for Prometheus scrapes, port 0 disables it
+	std::string metrics_address;
+	std::uint16_t metrics_port = 0;
+
+	// Unique number of a published configuration snapshot
+	unsigned long generation = 0;
+
+	// Compiled from servers by build_routes() when the snapshot is
+	// published. Copies share the table of the source, it refers to the
+	// records of the source until the copy is published itself.
+	typedef route_table<server_record> routes_t;
+	std::shared_ptr<const routes_t> routes;
+
+	void build_routes();
 
 	static void initialize();
 	static void init_listener(ekutils::epoll_d & poll);
@@ -112,8 +183,25 @@ extern settings default_conf;
 extern settings::basic_record default_record;
 extern const ekutils::matomic<std::shared_ptr<const settings>> & conf;
 
+// Configuration view of the current thread. Worker threads register a
+// reader and refresh the view only at quiescent points of their event
+// loop, so references returned by get() stay valid until the next one.
+// Readers take no locks and do no reference counting, an outdated
+// snapshot is freed after every worker has moved past it.
+class conf_reader final {
+public:
+	conf_reader();
+	conf_reader(const conf_reader &) = delete;
+	conf_reader & operator=(const conf_reader &) = delete;
+	~conf_reader();
+	static void quiescent();
+	// Unregistered threads refresh their view on every call
+	static const settings & get();
+	static std::shared_ptr<const settings> snapshot();
+};
+
 class conf_snap {
-	std::shared_ptr<const settings> snap = conf;
+	std::shared_ptr<const settings> snap = conf_reader::snapshot();
 public:
 	operator const std::shared_ptr<const settings>() & noexcept {
 		return snap;
@@ -140,6 +228,10 @@ public:
 
 void reload_configuration();
 
+// True if the file is a status, login or configuration file of a server
+// directory, its changes republish the configuration
+bool watched_file(const std::string & file);
+
 void check_domain(std::string & name);
 
 } // mcshub
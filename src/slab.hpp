@@ -0,0 +1,119 @@
+#ifndef _SLAB_HEAD
+#define _SLAB_HEAD
+
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace mcshub {
+
+// Compact reference to an object inside a slab. Generation makes
+// handles of destroyed objects invalid even if the slot was reused.
+struct slab_handle {
+	std::uint32_t index = ~std::uint32_t(0);
+	std::uint32_t generation = 0;
+	bool operator==(const slab_handle & other) const noexcept {
+		return index == other.index && generation == other.generation;
+	}
+	bool operator!=(const slab_handle & other) const noexcept {
+		return !(*this == other);
+	}
+};
+
+// Free list allocator with stable object addresses. Memory is taken in
+// chunks of chunk_size objects and never returned until destruction.
+template <typename T, std::size_t chunk_size = 256>
+class slab final {
+	struct slot {
+		alignas(T) unsigned char storage[sizeof(T)];
+		std::uint32_t generation = 0;
+		std::uint32_t next_free = 0;
+		bool alive = false;
+		T & object() noexcept {
+			return *std::launder(reinterpret_cast<T *>(storage));
+		}
+	};
+	typedef std::unique_ptr<slot[]> chunk;
+	static constexpr std::uint32_t nothing = ~std::uint32_t(0);
+	std::vector<chunk> chunks;
+	std::uint32_t free_head = nothing;
+	std::size_t count = 0;
+
+	slot & at(std::uint32_t index) noexcept {
+		return chunks[index / chunk_size][index % chunk_size];
+	}
+	std::uint32_t capacity() const noexcept {
+		return static_cast<std::uint32_t>(chunks.size() * chunk_size);
+	}
+	void grow() {
+		std::uint32_t first = capacity();
+		chunks.emplace_back(new slot[chunk_size]);
+		slot * fresh = chunks.back().get();
+		for (std::size_t i = chunk_size; i > 0; i--) {
+			fresh[i - 1].next_free = free_head;
+			free_head = first + static_cast<std::uint32_t>(i - 1);
+		}
+	}
+public:
+	slab() = default;
+	slab(const slab &) = delete;
+	slab & operator=(const slab &) = delete;
+	~slab() {
+		clear();
+	}
+	template <typename ...Args>
+	slab_handle emplace(Args &&... args) {
+		if (free_head == nothing)
+			grow();
+		std::uint32_t index = free_head;
+		slot & s = at(index);
+		new (s.storage) T(std::forward<Args>(args)...);
+		free_head = s.next_free;
+		s.alive = true;
+		count++;
+		return { index, s.generation };
+	}
+	T * get(slab_handle handle) noexcept {
+		if (handle.index >= capacity())
+			return nullptr;
+		slot & s = at(handle.index);
+		if (!s.alive || s.generation != handle.generation)
+			return nullptr;
+		return &s.object();
+	}
+	bool erase(slab_handle handle) noexcept {
+		if (!get(handle))
+			return false;
+		slot & s = at(handle.index);
+		s.alive = false;
+		s.generation++;
+		s.object().~T();
+		s.next_free = free_head;
+		free_head = handle.index;
+		count--;
+		return true;
+	}
+	template <typename F>
+	void for_each(F fun) {
+		for (auto & c : chunks)
+			for (std::size_t i = 0; i < chunk_size; i++)
+				if (c[i].alive)
+					fun(c[i].object());
+	}
+	void clear() noexcept {
+		for (std::uint32_t i = 0, cap = capacity(); i < cap; i++)
+			erase({ i, at(i).generation });
+	}
+	std::size_t size() const noexcept {
+		return count;
+	}
+	bool empty() const noexcept {
+		return count == 0;
+	}
+};
+
+} // namespace mcshub
+
+#endif // _SLAB_HEAD
@@ -0,0 +1,69 @@
+#include "splice_pipe.hpp"
+
+#include <cerrno>
+#include <system_error>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace mcshub {
+
+splice_pipe::~splice_pipe() {
+	close();
+}
+
+bool splice_pipe::open() noexcept {
+	int fds[2];
+	if (pipe2(fds, O_NONBLOCK | O_CLOEXEC) == -1)
+		return false;
+	read_end = fds[0];
+	write_end = fds[1];
+	pending = 0;
+	return true;
+}
+
+void splice_pipe::close() noexcept {
+	if (read_end != -1)
+		::close(read_end);
+	if (write_end != -1)
+		::close(write_end);
+	read_end = write_end = -1;
+	pending = 0;
+}
+
+splice_pipe::result splice_pipe::fill(int fd) {
+	ssize_t moved = splice(fd, nullptr, write_end, nullptr, chunk, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+	if (moved == -1) {
+		switch (errno) {
+			case EAGAIN:
+				return result::again;
+			case EINVAL:
+			case ENOSYS:
+				if (pending == 0)
+					return result::unsupported;
+				[[fallthrough]];
+			default:
+				throw std::system_error(errno, std::generic_category(), "splice from socket");
+		}
+	}
+	if (moved == 0)
+		// End of stream, rdhup event will close the connection
+		return result::again;
+	pending += moved;
+	return result::done;
+}
+
+splice_pipe::result splice_pipe::drain(int fd) {
+	while (pending) {
+		ssize_t moved = splice(read_end, nullptr, fd, nullptr, pending, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if (moved == -1) {
+			if (errno == EAGAIN)
+				return result::again;
+			throw std::system_error(errno, std::generic_category(), "splice to socket");
+		}
+		pending -= moved;
+	}
+	return result::done;
+}
+
+} // namespace mcshub
@@ -0,0 +1,41 @@
+#ifndef _SPLICE_PIPE_HEAD
+#define _SPLICE_PIPE_HEAD
+
+#include <cstddef>
+
+namespace mcshub {
+
+// Kernel pipe that is used as an intermediate buffer for splice(2).
+// Bytes moved into this pipe from one socket never visit user space.
+// A pipe can't be shared, bytes may stay in it until the peer socket
+// is writable again. So a spliced tunnel costs two pipes: four file
+// descriptors and up to 'chunk' bytes of kernel memory per direction.
+class splice_pipe final {
+	int read_end = -1, write_end = -1;
+	std::size_t pending = 0;
+public:
+	static constexpr std::size_t chunk = 65536;
+	enum class result {
+		done, again, unsupported
+	};
+	splice_pipe() noexcept {}
+	splice_pipe(const splice_pipe &) = delete;
+	splice_pipe & operator=(const splice_pipe &) = delete;
+	~splice_pipe();
+	bool is_open() const noexcept {
+		return read_end != -1;
+	}
+	std::size_t avail() const noexcept {
+		return pending;
+	}
+	bool open() noexcept;
+	void close() noexcept;
+	// socket -> pipe
+	result fill(int fd);
+	// pipe -> socket
+	result drain(int fd);
+};
+
+} // namespace mcshub
+
+#endif // _SPLICE_PIPE_HEAD
@@ -0,0 +1,102 @@
+#include "status_cache.hpp"
+
+#include "mc_pakets.hpp"
+
+namespace mcshub {
+
+void status_cache::reset(unsigned long gen) {
+	generation = gen;
+	frames_count = 0;
+	records.clear();
+}
+
+bool status_cache::usable(unsigned long gen) {
+	if (gen < generation)
+		return false;
+	if (gen > generation)
+		reset(gen);
+	return true;
+}
+
+status_cache::entry * status_cache::find(const settings::basic_record * record) {
+	auto iter = records.find(record);
+	return iter == records.end() ? nullptr : &iter->second;
+}
+
+status_cache::entry & status_cache::insert(const settings::basic_record * record, compiled_template && tmpl,
+		bool volatile_vars, bool uses_hs, bool uses_agg) {
+	entry & e = records[record];
+	e.tmpl = std::move(tmpl);
+	e.volatile_vars = volatile_vars;
+	e.uses_hs = uses_hs;
+	e.uses_agg = uses_agg;
+	return e;
+}
+
+void status_cache::renew(entry & e, unsigned long revision) {
+	if (e.revision == revision)
+		return;
+	frames_count -= e.frames.size();
+	e.frames.clear();
+	e.revision = revision;
+}
+
+std::string status_cache::frame_key(const entry & e, const pakets::handshake & hs) {
+	if (!e.uses_hs)
+		return {};
+	return std::to_string(hs.version()) + ':' + std::to_string(hs.port()) + ':' + hs.address();
+}
+
+const status_cache::frame_t * status_cache::find_frame(const entry & e, const std::string & key) const {
+	auto iter = e.frames.find(key);
+	return iter == e.frames.end() ? nullptr : &iter->second;
+}
+
+const status_cache::frame_t & status_cache::store(entry & e, const std::string & key, const std::string & message) {
+	if (frames_count >= max_frames) {
+		// Too many handshake variations, start again
+		for (auto & pair : records)
+			pair.second.frames.clear();
+		frames_count = 0;
+	}
+	frame_t & frame = e.frames[key] = serialize(message);
+	frames_count++;
+	return frame;
+}
+
+const compiled_template * status_cache::find_template(unsigned long gen, template_t kind,
+		const settings::basic_record * record) const {
+	auto compiled = templates.find(gen);
+	if (compiled == templates.end())
+		return nullptr;
+	auto iter = compiled->second.find({ record, kind });
+	return iter == compiled->second.end() ? nullptr : &iter->second;
+}
+
+const compiled_template & status_cache::store_template(unsigned long gen, template_t kind,
+		const settings::basic_record * record, compiled_template && tmpl) {
+	compiled_template & result = templates[gen][{ record, kind }] = std::move(tmpl);
+	while (templates.size() > max_generations) {
+		auto oldest = templates.begin();
+		if (oldest->first == gen)
+			oldest++;
+		templates.erase(oldest);
+	}
+	return result;
+}
+
+status_cache::frame_t status_cache::serialize(const std::string & message) {
+	pakets::response response;
+	response.message() = message;
+	frame_t frame(10 + response.size());
+	int s = response.write(frame.data(), frame.size());
+	frame.resize(s < 0 ? 0 : std::size_t(s));
+	return frame;
+}
+
+status_cache & status_cache::local() {
+	thread_local status_cache cache;
+	return cache;
+}
+
+} // namespace mcshub
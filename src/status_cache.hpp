@@ -0,0 +1,81 @@
+#ifndef _STATUS_CACHE_HEAD
+#define _STATUS_CACHE_HEAD
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <map>
+
+#include <ekutils/primitives.hpp>
+
+#include "settings.hpp"
+#include "response_props.hpp"
+#include "mc_pakets.hpp"
+
+namespace mcshub {
+
+using ekutils::byte_t;
+
+// Per thread cache of serialized status responses. Entries belong to one
+// configuration generation, a new generation drops all of them. Settings
+// are republished when a status file of a server directory changes, so
+// those files invalidate the cache too. Templates of other files and
+// templates that read files through variables are not cached. Compiled
+// status and login templates of the recent generations are kept apart
+// from frames, so connections of outdated configurations don't compile
+// them again.
+class status_cache final {
+public:
+	typedef std::vector<byte_t> frame_t;
+	enum class template_t {
+		status, login
+	};
+	struct entry {
+		compiled_template tmpl;
+		// Template uses variables that change on every request
+		bool volatile_vars = false;
+		// Template uses handshake variables
+		bool uses_hs = false;
+		// Template uses aggregated status, frames belong to its revision
+		bool uses_agg = false;
+		unsigned long revision = 0;
+		std::unordered_map<std::string, frame_t> frames;
+	};
+	static constexpr std::size_t max_frames = 4096;
+	static constexpr std::size_t max_generations = 4;
+private:
+	unsigned long generation = 0;
+	std::size_t frames_count = 0;
+	std::unordered_map<const settings::basic_record *, entry> records;
+	typedef std::pair<const settings::basic_record *, template_t> template_key;
+	struct template_hash {
+		std::size_t operator()(const template_key & key) const noexcept {
+			return std::hash<const void *>()(key.first) ^ std::size_t(key.second);
+		}
+	};
+	std::map<unsigned long, std::unordered_map<template_key, compiled_template, template_hash>> templates;
+	void reset(unsigned long gen);
+public:
+	// Returns false if the configuration snapshot is older than cached one
+	bool usable(unsigned long gen);
+	entry * find(const settings::basic_record * record);
+	entry & insert(const settings::basic_record * record, compiled_template && tmpl,
+		bool volatile_vars, bool uses_hs, bool uses_agg = false);
+	// Drops frames of the entry rendered for another revision
+	void renew(entry & e, unsigned long revision);
+	// Frame key of a request, made of what the template reads
+	static std::string frame_key(const entry & e, const pakets::handshake & hs);
+	const frame_t * find_frame(const entry & e, const std::string & key) const;
+	const frame_t & store(entry & e, const std::string & key, const std::string & message);
+	// Null if the template of the record is not compiled in the generation
+	const compiled_template * find_template(unsigned long gen, template_t kind, const settings::basic_record * record) const;
+	// Templates of the oldest generations are dropped
+	const compiled_template & store_template(unsigned long gen, template_t kind,
+		const settings::basic_record * record, compiled_template && tmpl);
+	static frame_t serialize(const std::string & message);
+	static status_cache & local();
+};
+
+} // namespace mcshub
+
+#endif // _STATUS_CACHE_HEAD
@@ -1,18 +1,35 @@
 #include "thread_controller.hpp"
 
+#include <algorithm>
 #include <stdexcept>
+#include <system_error>
+
+#include <poll.h>
 
 #include "settings.hpp"
+#include "logging.hpp"
 
 namespace mcshub {
 
 std::uint16_t thread_controller::real_port = 0;
 
-worker::worker() : working(true) {
+// Submission queue size of a worker ring
+constexpr unsigned ring_entries = 256;
+// Completion of the poll on the epoll descriptor
+constexpr std::uint64_t epoll_ready = ~std::uint64_t(0);
+
+worker::worker() : backends(poll), working(true) {
 	conf_snap c;
 	listener.listen(c->address, c->port | thread_controller::real_port, ekutils::tcp_flags::reuse_port);
 	listener.start();
 	thread_controller::real_port = listener.local_endpoint().port();
+	if (c->io_backend == settings::io_backend_t::uring) {
+		try {
+			ring = std::make_unique<uring>(ring_entries, c->uring_buffers);
+		} catch (const std::system_error & e) {
+			lazy_warning(std::string("io_uring can't be used, epoll is used instead: ") + e.what());
+		}
+	}
 	poll.add(listener, [this](ekutils::descriptor & fd, std::uint32_t events) {
 		on_accept(fd, events);
 	});
@@ -21,39 +38,106 @@ worker::worker() : working(true) {
 	poll.add(events, in | out | et, [this](ekutils::descriptor & fd, std::uint32_t events) {
 		on_event(fd, events);
 	});
+	poll.add(resolved, in | et, [this](ekutils::descriptor & fd, std::uint32_t events) {
+		on_resolved(fd, events);
+	});
+	timers.attach(poll);
+	maintenance.bind([this]() {
+		try {
+			backends.maintain(conf_reader::get(), resolved);
+		} catch (const std::exception & e) {
+			lazy_error("backend pool maintenance failed");
+			lazy_error(e);
+		}
+		// Workers without pools don't wake up until a new configuration
+		if (!backends.empty())
+			schedule_maintain();
+	});
 	task = std::async(std::launch::async, [this]() { job(); });
 }
 
+worker::~worker() {
+	hosts_db::instance().cancel(resolved);
+}
+
 void worker::on_accept(ekutils::descriptor &, std::uint32_t) {
-	auto & client = clients.emplace_front(listener.accept(), poll);
-	log_verbose("new client " + std::string(client.sock().remote_endpoint()));
+	slab_handle handle = clients.emplace(listener.accept(), poll, resolved, backends, timers, ring.get());
+	metrics::local().add(metrics::counter_t::accepts);
+	auto & client = *clients.get(handle);
+	client.attach(handle, [this, handle]() {
+		on_client_timeout(handle);
+	});
+	lazy_verbose("new client " + std::string(client.sock().remote_endpoint()));
 	auto & sock = client.sock();
 	sock.set_non_block();
-	const auto & it = clients.cbegin();
 	std::hash<std::thread::id> hasher;
-	log_debug("client " + std::string(sock.remote_endpoint()) + " is on thread #" + std::to_string(hasher(std::this_thread::get_id())));
+	lazy_debug("client " + std::string(sock.remote_endpoint()) + " is on thread #" + std::to_string(hasher(std::this_thread::get_id())));
 	using namespace ekutils::actions;
-	poll.add(sock, in | out | et | err | rdhup, [this, &client, it](ekutils::descriptor &, std::uint32_t events) {
-		client.on_from_event(events);
-		if (client.is_disconnected()) {
-			log_verbose("client " + std::string(client.sock().remote_endpoint()) + " disconnected");
-			clients.erase(it);
-		}
+	poll.add(sock, in | out | et | err | rdhup, [this, handle](ekutils::descriptor &, std::uint32_t events) {
+		on_client_event(handle, events);
 	});
 }
 
+void worker::on_client_event(slab_handle handle, std::uint32_t events) {
+	portal * client = clients.get(handle);
+	if (!client)
+		return;
+	client->on_from_event(events);
+	settle(handle, *client);
+}
+
+void worker::on_client_timeout(slab_handle handle) {
+	if (portal * client = clients.get(handle)) {
+		client->on_timeout();
+		settle(handle, *client);
+	}
+}
+
+void worker::on_resolved(ekutils::descriptor &, std::uint32_t) {
+	resolved.take(answers);
+	for (auto & answer : answers) {
+		// Client may have gone while its backend name was resolving
+		if (portal * client = clients.get(answer.client)) {
+			client->on_resolved(answer.answer);
+			settle(answer.client, *client);
+		} else if (answer.client == slab_handle {}) {
+			backends.on_resolved(answer);
+		}
+	}
+	answers.clear();
+}
+
+void worker::settle(slab_handle handle, portal & client) {
+	if (client.is_disconnected()) {
+		if (client.ring_busy()) {
+			// Erased when the kernel completes its operations
+			client.ring_shutdown();
+			return;
+		}
+		lazy_verbose("client " + std::string(client.sock().remote_endpoint()) + " disconnected");
+		clients.erase(handle);
+		metrics::local().add(metrics::counter_t::closes);
+	} else if (ring && client.ring_ready()) {
+		handovers.push_back(handle);
+	}
+}
+
+void worker::schedule_maintain() {
+	timers.arm(maintenance, backend_pool::period);
+}
+
 void worker::on_event(ekutils::descriptor &, std::uint32_t e) {
-	log_debug("worker event occurs");
+	lazy_debug("worker event occurs");
 	if (e & ekutils::actions::in) {
 		switch (events.read()) {
 			case worker_events::event_t::noop:
 				break;
 			case worker_events::event_t::stop:
 				working = false;
-				log_debug("disconnecting clients...");
-				for (portal & c : clients) {
+				lazy_debug("disconnecting clients...");
+				clients.for_each([](portal & c) {
 					c.on_disconnect();
-				}
+				});
 				break;
 			default:
 				throw std::runtime_error("undefined worker event type");
@@ -61,11 +145,77 @@ void worker::on_event(ekutils::descriptor &, std::uint32_t e) {
 	}
 }
 
+void worker::on_ring(const uring::completion & result) {
+	slab_handle handle = portal::ring_owner(result.data);
+	portal * client = clients.get(handle);
+	if (!client) {
+		if (result.buffer != -1)
+			ring->recycle(result.buffer);
+		return;
+	}
+	client->on_ring(result);
+	if (client->is_starved())
+		starving.push_back(handle);
+	settle(handle, *client);
+}
+
+void worker::wait_ring() {
+	// Epoll handlers run when the ring reports the epoll descriptor
+	// readable, the poll is armed again for every wait
+	if (!ring_polling)
+		ring_polling = ring->prepare_poll(poll.get_handle(), POLLIN, epoll_ready);
+	ring->submit(1);
+	ring->for_each_completion([this](const uring::completion & result) {
+		if (result.data == epoll_ready) {
+			ring_polling = false;
+			poll.wait(0);
+		} else {
+			on_ring(result);
+		}
+	});
+	// Sockets leave epoll outside of their handlers
+	for (slab_handle handle : handovers) {
+		if (portal * client = clients.get(handle)) {
+			client->try_ring();
+			if (client->is_starved())
+				starving.push_back(handle);
+		}
+	}
+	handovers.clear();
+	// Receives that may take a buffer without failing again, flows that
+	// still find the ring full wait for the next round
+	std::size_t resumed = std::min<std::size_t>(starving.size(), ring->free_buffers());
+	std::vector<slab_handle> retry(starving.begin(), starving.begin() + resumed);
+	starving.erase(starving.begin(), starving.begin() + resumed);
+	for (slab_handle handle : retry) {
+		if (portal * client = clients.get(handle)) {
+			client->ring_resume();
+			if (client->is_starved())
+				starving.push_back(handle);
+		}
+	}
+}
+
 void worker::job() {
-	log_debug("thread spawned");
+	lazy_debug("thread spawned");
+	conf_reader reader;
+	unsigned long generation = 0;
 	while (working) {
+		// No configuration references are held between iterations
+		conf_reader::quiescent();
+		health_checker::quiescent();
+		// New configuration may have records with pools
+		unsigned long current = conf_reader::get().generation;
+		if (current != generation) {
+			generation = current;
+			if (!maintenance.armed())
+				schedule_maintain();
+		}
 		try {
-			poll.wait(-1);
+			if (ring)
+				wait_ring();
+			else
+				poll.wait(-1);
 		} catch (...) {}
 	}
 }
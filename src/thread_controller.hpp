@@ -2,7 +2,6 @@
 #define _THREAD_CONTROLLER_HEAD
 
 #include <future>
-#include <list>
 #include <vector>
 #include <atomic>
 #include <memory>
@@ -13,6 +12,8 @@
 #include <ekutils/event_d.hpp>
 
 #include "client.hpp"
+#include "slab.hpp"
+#include "uring.hpp"
 
 namespace mcshub {
 
@@ -31,17 +32,38 @@ public:
 };
 
 class worker final {
+public:
+	ekutils::epoll_d poll;
+private:
 	std::future<void> task;
 	ekutils::tcp_listener_d listener;
 	worker_events events;
-	std::list<portal> clients;
+	hosts_db::mailbox resolved;
+	std::vector<hosts_db::completion> answers;
+	// Declared before the portals, it outlives their operations
+	std::unique_ptr<uring> ring;
+	bool ring_polling = false;
+	// Portals that can move to the ring and that wait for its buffers
+	std::vector<slab_handle> handovers, starving;
+	// Declared before the portals, their timers are unlinked first
+	timer_wheel timers;
+	slab<portal> clients;
+	backend_pool backends;
+	timer_wheel::timer maintenance;
 	std::atomic<bool> working;
 	void on_accept(ekutils::descriptor &, std::uint32_t);
+	void on_client_event(slab_handle handle, std::uint32_t events);
+	void on_client_timeout(slab_handle handle);
+	void on_resolved(ekutils::descriptor &, std::uint32_t events);
+	void settle(slab_handle handle, portal & client);
+	void schedule_maintain();
 	void on_event(ekutils::descriptor &, std::uint32_t e);
+	void on_ring(const uring::completion & result);
+	void wait_ring();
 	void job();
 public:
-	ekutils::epoll_d poll;
 	worker();
+	~worker();
 	std::future<void> & stop();
 };
 
@@ -0,0 +1,207 @@
+#include "timer_wheel.hpp"
+
+#include <algorithm>
+#include <system_error>
+
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#include "logging.hpp"
+
+namespace mcshub {
+
+timer_wheel::ticker::ticker() {
+	handle = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (handle == -1)
+		throw std::system_error(errno, std::system_category(), "timerfd_create");
+}
+
+void timer_wheel::ticker::set(clock::duration at) {
+	// Steady clock of the standard library is CLOCK_MONOTONIC
+	auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(at).count();
+	itimerspec spec {};
+	spec.it_value.tv_sec = ns / 1000000000;
+	spec.it_value.tv_nsec = ns % 1000000000;
+	if (timerfd_settime(handle, TFD_TIMER_ABSTIME, &spec, nullptr) == -1)
+		throw std::system_error(errno, std::system_category(), "timerfd_settime");
+}
+
+void timer_wheel::ticker::drain() noexcept {
+	std::uint64_t expirations;
+	while (::read(handle, &expirations, sizeof(expirations)) > 0);
+}
+
+void timer_wheel::timer::cancel() noexcept {
+	if (!wheel)
+		return;
+	unlink();
+	wheel->count--;
+	wheel = nullptr;
+}
+
+timer_wheel::timer_wheel(std::chrono::milliseconds t) : tick(t), origin(clock::now()) {}
+
+timer_wheel::~timer_wheel() {
+	// Timers may outlive the wheel, they just become disarmed
+	for (auto & level : wheel) {
+		for (link & slot : level) {
+			while (slot.linked()) {
+				timer & t = static_cast<timer &>(*slot.next);
+				t.unlink();
+				t.wheel = nullptr;
+			}
+		}
+	}
+}
+
+std::uint64_t timer_wheel::tick_of(clock::time_point time) const noexcept {
+	if (time <= origin)
+		return 0;
+	return std::uint64_t((time - origin) / tick);
+}
+
+timer_wheel::clock::time_point timer_wheel::time_of(std::uint64_t t) const noexcept {
+	return origin + std::chrono::duration_cast<clock::duration>(tick * std::int64_t(t));
+}
+
+void timer_wheel::place(timer & t) noexcept {
+	constexpr std::uint64_t range = std::uint64_t(1) << (level_bits * levels);
+	std::uint64_t delta = t.expires > now ? t.expires - now : 0;
+	// Timers beyond the range wait in the last level and are placed again
+	std::uint64_t key = delta < range ? t.expires : now + range - 1;
+	if (delta >= range)
+		delta = range - 1;
+	unsigned level = 0;
+	while (level + 1 < levels && delta >= (std::uint64_t(1) << (level_bits * (level + 1))))
+		level++;
+	wheel[level][(key >> (level_bits * level)) & (slots - 1)].push_back(t);
+}
+
+void timer_wheel::cascade(unsigned level) noexcept {
+	link & slot = wheel[level][(now >> (level_bits * level)) & (slots - 1)];
+	link moving;
+	if (slot.linked()) {
+		moving.next = slot.next;
+		moving.prev = slot.prev;
+		moving.next->prev = moving.prev->next = &moving;
+		slot.prev = slot.next = &slot;
+	}
+	while (moving.linked()) {
+		timer & t = static_cast<timer &>(*moving.next);
+		t.unlink();
+		place(t);
+	}
+}
+
+std::size_t timer_wheel::step() {
+	now++;
+	for (unsigned level = 1; level < levels; level++) {
+		if (now & ((std::uint64_t(1) << (level_bits * level)) - 1))
+			break;
+		cascade(level);
+	}
+	link & slot = wheel[0][now & (slots - 1)];
+	if (!slot.linked())
+		return 0;
+	// Actions may arm and cancel other timers, even the due ones
+	link due;
+	due.next = slot.next;
+	due.prev = slot.prev;
+	due.next->prev = due.prev->next = &due;
+	slot.prev = slot.next = &slot;
+	std::size_t fired = 0;
+	while (due.linked()) {
+		timer & t = static_cast<timer &>(*due.next);
+		t.unlink();
+		t.wheel = nullptr;
+		count--;
+		fired++;
+		if (!t.action)
+			continue;
+		try {
+			t.action();
+		} catch (const std::exception & e) {
+			lazy_error("timer action failed");
+			lazy_error(e);
+		}
+	}
+	return fired;
+}
+
+void timer_wheel::attach(ekutils::epoll_d & p) {
+	poll = &p;
+	poll->add(fd, ekutils::actions::in, [this](ekutils::descriptor &, std::uint32_t) {
+		on_tick();
+	});
+}
+
+void timer_wheel::arm(timer & t, std::chrono::milliseconds delay) {
+	t.cancel();
+	auto time = clock::now();
+	if (!count) {
+		// Nothing is pending, the wheel just catches up with the clock
+		std::uint64_t current = tick_of(time);
+		if (current > now)
+			now = current;
+	}
+	// Rounded up to the whole tick
+	auto offset = std::chrono::duration_cast<std::chrono::nanoseconds>(time + delay - origin);
+	auto tick_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(tick);
+	std::uint64_t expires = std::uint64_t((offset + tick_ns - std::chrono::nanoseconds(1)) / tick_ns);
+	if (expires <= now)
+		expires = now + 1;
+	t.expires = expires;
+	t.wheel = this;
+	count++;
+	place(t);
+	if (poll && (!wake || expires < wake))
+		program(expires);
+}
+
+std::size_t timer_wheel::expire(clock::time_point time) {
+	std::uint64_t target = tick_of(time);
+	std::size_t fired = 0;
+	while (now < target && count)
+		fired += step();
+	if (now < target)
+		now = target;
+	return fired;
+}
+
+std::uint64_t timer_wheel::next_tick() const noexcept {
+	// Slots of the upper levels are due when they cascade
+	std::uint64_t result = ~std::uint64_t(0);
+	for (unsigned level = 0; level < levels; level++) {
+		unsigned shift = level_bits * level;
+		std::uint64_t base = now >> shift;
+		for (std::uint64_t k = 1; k <= slots; k++) {
+			if (wheel[level][(base + k) & (slots - 1)].linked()) {
+				result = std::min(result, (base + k) << shift);
+				break;
+			}
+		}
+	}
+	return result;
+}
+
+timer_wheel::clock::time_point timer_wheel::next_deadline() const noexcept {
+	if (!count)
+		return clock::time_point::max();
+	return time_of(next_tick());
+}
+
+void timer_wheel::program(std::uint64_t at) {
+	wake = at;
+	fd.set(at ? time_of(at).time_since_epoch() : clock::duration::zero());
+}
+
+void timer_wheel::on_tick() {
+	fd.drain();
+	expire();
+	if (count)
+		program(next_tick());
+	else if (wake)
+		program(0);
+}
+
+} // namespace mcshub
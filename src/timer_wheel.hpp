@@ -0,0 +1,119 @@
+#ifndef _TIMER_WHEEL_HEAD
+#define _TIMER_WHEEL_HEAD
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+
+#include <ekutils/epoll_d.hpp>
+#include <ekutils/descriptor.hpp>
+
+namespace mcshub {
+
+// Hierarchical timing wheel of one worker. Timers are intrusive list
+// nodes, so arming and cancelling them is O(1) without allocations.
+// Deadlines are rounded up to the tick, the whole wheel is driven by a
+// single one-shot timerfd set to the next tick that has timers to fire
+// or to move to a lower level.
+class timer_wheel final {
+	struct link {
+		link * prev = this;
+		link * next = this;
+		bool linked() const noexcept {
+			return next != this;
+		}
+		void unlink() noexcept {
+			prev->next = next;
+			next->prev = prev;
+			prev = next = this;
+		}
+		void push_back(link & node) noexcept {
+			node.prev = prev;
+			node.next = this;
+			prev->next = &node;
+			prev = &node;
+		}
+	};
+public:
+	typedef std::chrono::steady_clock clock;
+	typedef std::function<void()> action_t;
+
+	class timer final : private link {
+		friend class timer_wheel;
+		timer_wheel * wheel = nullptr;
+		std::uint64_t expires = 0;
+		action_t action;
+	public:
+		timer() = default;
+		explicit timer(action_t && act) : action(std::move(act)) {}
+		timer(const timer &) = delete;
+		timer & operator=(const timer &) = delete;
+		~timer() {
+			cancel();
+		}
+		void bind(action_t && act) {
+			action = std::move(act);
+		}
+		void cancel() noexcept;
+		bool armed() const noexcept {
+			return wheel != nullptr;
+		}
+	};
+
+	static constexpr unsigned level_bits = 6;
+	static constexpr unsigned slots = 1u << level_bits;
+	static constexpr unsigned levels = 4;
+	static constexpr std::chrono::milliseconds default_tick { 100 };
+private:
+	class ticker final : public ekutils::descriptor {
+	public:
+		ticker();
+		// Fires once at the time of the monotonic clock, zero disarms it
+		void set(clock::duration at);
+		void drain() noexcept;
+	};
+	std::array<std::array<link, slots>, levels> wheel;
+	std::chrono::milliseconds tick;
+	clock::time_point origin;
+	// Last processed tick
+	std::uint64_t now = 0;
+	std::size_t count = 0;
+	ekutils::epoll_d * poll = nullptr;
+	ticker fd;
+	// Tick the timerfd is set to, zero if it is disarmed
+	std::uint64_t wake = 0;
+
+	std::uint64_t tick_of(clock::time_point time) const noexcept;
+	clock::time_point time_of(std::uint64_t t) const noexcept;
+	void place(timer & t) noexcept;
+	void cascade(unsigned level) noexcept;
+	std::size_t step();
+	std::uint64_t next_tick() const noexcept;
+	void program(std::uint64_t at);
+	void on_tick();
+public:
+	explicit timer_wheel(std::chrono::milliseconds t = default_tick);
+	timer_wheel(const timer_wheel &) = delete;
+	timer_wheel & operator=(const timer_wheel &) = delete;
+	~timer_wheel();
+	// Drive the wheel by the epoll of the worker
+	void attach(ekutils::epoll_d & p);
+	// Arms or rearms the timer, it fires not earlier than after delay
+	void arm(timer & t, std::chrono::milliseconds delay);
+	// Fires timers that are due by the time, returns their count
+	std::size_t expire(clock::time_point time = clock::now());
+	// Time the wheel should be expired at next, not later than any armed
+	// deadline, time_point::max() if nothing is armed
+	clock::time_point next_deadline() const noexcept;
+	std::size_t size() const noexcept {
+		return count;
+	}
+	bool empty() const noexcept {
+		return count == 0;
+	}
+};
+
+} // namespace mcshub
+
+#endif // _TIMER_WHEEL_HEAD
@@ -0,0 +1,249 @@
+#include "uring.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <system_error>
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace mcshub {
+
+namespace {
+
+constexpr std::uint16_t buffer_group = 0;
+// Marks the entry that cancels everything on destruction
+constexpr std::uint64_t cancel_data = ~std::uint64_t(1);
+
+void * map(std::size_t size, int fd, off_t offset) noexcept {
+	int flags = fd == -1 ? MAP_PRIVATE | MAP_ANONYMOUS : MAP_SHARED | MAP_POPULATE;
+	void * result = mmap(nullptr, size, PROT_READ | PROT_WRITE, flags, fd, offset);
+	return result == MAP_FAILED ? nullptr : result;
+}
+
+template <typename T>
+T * at(void * ring, std::uint32_t offset) noexcept {
+	return reinterpret_cast<T *>(reinterpret_cast<std::uint8_t *>(ring) + offset);
+}
+
+} // namespace
+
+uring::uring(unsigned entries, unsigned count) {
+	io_uring_params params;
+	std::memset(&params, 0, sizeof(params));
+	// Every tunnel keeps up to four operations in flight
+	params.flags = IORING_SETUP_CQSIZE;
+	params.cq_entries = entries * 4;
+	fd = int(syscall(__NR_io_uring_setup, entries, &params));
+	if (fd == -1)
+		throw std::system_error(errno, std::generic_category(), "io_uring_setup");
+	sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+		sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+	sq_ring = map(sq_ring_size, fd, IORING_OFF_SQ_RING);
+	if (sq_ring && (params.features & IORING_FEAT_SINGLE_MMAP))
+		cq_ring = sq_ring;
+	else if (sq_ring)
+		cq_ring = map(cq_ring_size, fd, IORING_OFF_CQ_RING);
+	if (cq_ring)
+		sqes = static_cast<io_uring_sqe *>(map(params.sq_entries * sizeof(io_uring_sqe), fd, IORING_OFF_SQES));
+	if (!sqes) {
+		int err = errno;
+		release();
+		throw std::system_error(err, std::generic_category(), "io_uring mmap");
+	}
+	sq_entries = params.sq_entries;
+	sq_tail = at<unsigned>(sq_ring, params.sq_off.tail);
+	sq_mask = *at<unsigned>(sq_ring, params.sq_off.ring_mask);
+	sq_array = at<unsigned>(sq_ring, params.sq_off.array);
+	cq_head = at<unsigned>(cq_ring, params.cq_off.head);
+	cq_tail = at<unsigned>(cq_ring, params.cq_off.tail);
+	cq_mask = *at<unsigned>(cq_ring, params.cq_off.ring_mask);
+	cq_entries = params.cq_entries;
+	cqes = at<io_uring_cqe>(cq_ring, params.cq_off.cqes);
+
+	if (!count || count > 32768 || (count & (count - 1))) {
+		release();
+		throw std::system_error(EINVAL, std::generic_category(), "io_uring buffer count");
+	}
+	buffer_count = count;
+	buf_ring = static_cast<io_uring_buf_ring *>(map(count * sizeof(io_uring_buf), -1, 0));
+	buffers = static_cast<std::uint8_t *>(map(count * buffer_size, -1, 0));
+	if (!buf_ring || !buffers) {
+		int err = errno;
+		release();
+		throw std::system_error(err, std::generic_category(), "io_uring buffers");
+	}
+	io_uring_buf_reg reg;
+	std::memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = reinterpret_cast<std::uintptr_t>(buf_ring);
+	reg.ring_entries = count;
+	reg.bgid = buffer_group;
+	// Linux 5.19 or newer
+	if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PBUF_RING, &reg, 1) == -1) {
+		int err = errno;
+		release();
+		throw std::system_error(err, std::generic_category(), "io_uring buffer ring");
+	}
+	for (unsigned id = 0; id < count; id++)
+		provide(id);
+}
+
+uring::~uring() {
+	if (inflight) {
+		// Kernel may still write to the buffers, wait until it gives them up
+		if (io_uring_sqe * sqe = next(true)) {
+			sqe->opcode = IORING_OP_ASYNC_CANCEL;
+			sqe->fd = -1;
+			sqe->cancel_flags = IORING_ASYNC_CANCEL_ANY;
+			sqe->user_data = cancel_data;
+		}
+		io_uring_getevents_arg arg;
+		std::memset(&arg, 0, sizeof(arg));
+		__kernel_timespec timeout { 0, 100000000 };
+		arg.ts = reinterpret_cast<std::uintptr_t>(&timeout);
+		for (int attempt = 0; inflight && attempt < 10; attempt++) {
+			long submitted = syscall(__NR_io_uring_enter, fd, queued, 1,
+				IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+			if (submitted > 0)
+				queued -= unsigned(submitted);
+			completion result;
+			while (pop(result));
+		}
+	}
+	release();
+}
+
+void uring::release() noexcept {
+	if (buffers)
+		munmap(buffers, buffer_count * buffer_size);
+	if (buf_ring)
+		munmap(buf_ring, buffer_count * sizeof(io_uring_buf));
+	if (sqes)
+		munmap(sqes, sq_entries * sizeof(io_uring_sqe));
+	if (cq_ring && cq_ring != sq_ring)
+		munmap(cq_ring, cq_ring_size);
+	if (sq_ring)
+		munmap(sq_ring, sq_ring_size);
+	if (fd != -1)
+		close(fd);
+	buffers = nullptr;
+	buf_ring = nullptr;
+	sqes = nullptr;
+	sq_ring = cq_ring = nullptr;
+	fd = -1;
+}
+
+void uring::provide(unsigned id) noexcept {
+	// Entries start at the ring itself, C++ places the flexible bufs
+	// array of the kernel header after an empty struct
+	io_uring_buf & slot = reinterpret_cast<io_uring_buf *>(buf_ring)[buf_tail & (buffer_count - 1)];
+	slot.addr = reinterpret_cast<std::uintptr_t>(buffer(int(id)));
+	slot.len = buffer_size;
+	slot.bid = std::uint16_t(id);
+	buf_tail++;
+	__atomic_store_n(&buf_ring->tail, buf_tail, __ATOMIC_RELEASE);
+	free_count++;
+}
+
+void uring::recycle(int id) noexcept {
+	provide(unsigned(id));
+}
+
+io_uring_sqe * uring::next(bool reserved) {
+	// Completion ring must have room for every operation in flight
+	if (inflight + (reserved ? 0 : reserved_slots) >= cq_entries)
+		return nullptr;
+	if (queued == sq_entries) {
+		submit(0);
+		// Slots the kernel hasn't consumed yet are never overwritten
+		if (queued == sq_entries)
+			return nullptr;
+	}
+	unsigned tail = *sq_tail;
+	unsigned index = tail & sq_mask;
+	io_uring_sqe & sqe = sqes[index];
+	std::memset(&sqe, 0, sizeof(sqe));
+	sq_array[index] = index;
+	// Kernel reads the entry only after io_uring_enter(2)
+	__atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+	queued++;
+	inflight++;
+	return &sqe;
+}
+
+bool uring::prepare_poll(int target, std::uint32_t events, std::uint64_t data) {
+	io_uring_sqe * sqe = next(true);
+	if (!sqe)
+		return false;
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = target;
+	sqe->poll32_events = events;
+	sqe->user_data = data;
+	return true;
+}
+
+bool uring::prepare_recv(int target, std::uint64_t data) {
+	io_uring_sqe * sqe = next();
+	if (!sqe)
+		return false;
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = target;
+	sqe->len = buffer_size;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = buffer_group;
+	sqe->user_data = data;
+	return true;
+}
+
+bool uring::prepare_send(int target, const void * bytes, std::size_t length, std::uint64_t data) {
+	io_uring_sqe * sqe = next();
+	if (!sqe)
+		return false;
+	sqe->opcode = IORING_OP_SEND;
+	sqe->fd = target;
+	sqe->addr = reinterpret_cast<std::uintptr_t>(bytes);
+	sqe->len = unsigned(length);
+	sqe->msg_flags = MSG_NOSIGNAL;
+	sqe->user_data = data;
+	return true;
+}
+
+void uring::submit(unsigned wait) {
+	long submitted = syscall(__NR_io_uring_enter, fd, queued, wait, wait ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+	if (submitted == -1) {
+		switch (errno) {
+			case EINTR:
+			case EAGAIN:
+			case EBUSY:
+				// Completions should be taken first
+				return;
+			default:
+				throw std::system_error(errno, std::generic_category(), "io_uring_enter");
+		}
+	}
+	queued -= unsigned(submitted);
+}
+
+bool uring::pop(completion & result) noexcept {
+	unsigned head = *cq_head;
+	if (head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE))
+		return false;
+	const io_uring_cqe & cqe = cqes[head & cq_mask];
+	result.data = cqe.user_data;
+	result.result = cqe.res;
+	result.buffer = (cqe.flags & IORING_CQE_F_BUFFER) ? int(cqe.flags >> IORING_CQE_BUFFER_SHIFT) : -1;
+	if (result.buffer != -1)
+		free_count--;
+	if (!(cqe.flags & IORING_CQE_F_MORE))
+		inflight--;
+	__atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+	return true;
+}
+
+} // namespace mcshub
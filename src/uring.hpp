@@ -0,0 +1,91 @@
+#ifndef _URING_HEAD
+#define _URING_HEAD
+
+#include <cstdint>
+#include <cstddef>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+struct io_uring_buf_ring;
+
+namespace mcshub {
+
+// io_uring instance over raw system calls. Entries are queued with
+// prepare_*() and go to the kernel in one io_uring_enter(2) call with
+// submit(). Received bytes land in a ring of buffers provided to the
+// kernel, every recv completion tells which buffer it took. The buffer
+// belongs to the caller until it is recycled. An entry is not queued
+// when the submission ring stays full or the completions of the
+// operations in flight would not fit in the completion ring.
+class uring final {
+public:
+	struct completion {
+		std::uint64_t data;
+		std::int32_t result;
+		// Provided buffer with the received bytes, -1 if none was taken
+		int buffer;
+	};
+	static constexpr std::size_t buffer_size = 16384;
+	// Completion slots kept for prepare_poll() and the final cancel
+	static constexpr unsigned reserved_slots = 2;
+private:
+	int fd = -1;
+	void * sq_ring = nullptr, * cq_ring = nullptr;
+	std::size_t sq_ring_size = 0, cq_ring_size = 0;
+	unsigned * sq_tail = nullptr, * sq_array = nullptr;
+	unsigned sq_mask = 0, sq_entries = 0, queued = 0;
+	io_uring_sqe * sqes = nullptr;
+	unsigned * cq_head = nullptr, * cq_tail = nullptr;
+	unsigned cq_mask = 0, cq_entries = 0;
+	io_uring_cqe * cqes = nullptr;
+	io_uring_buf_ring * buf_ring = nullptr;
+	std::uint8_t * buffers = nullptr;
+	unsigned buffer_count = 0, free_count = 0;
+	std::uint16_t buf_tail = 0;
+	// Operations that will still post a completion
+	unsigned inflight = 0;
+	// Null if there is no room, reserved entries may take the last slots
+	io_uring_sqe * next(bool reserved = false);
+	void provide(unsigned id) noexcept;
+	void release() noexcept;
+public:
+	// buffers should be a power of two up to 32768, io_uring_setup(2)
+	// and buffer registration failures are thrown as std::system_error
+	uring(unsigned entries, unsigned buffers);
+	uring(const uring &) = delete;
+	uring & operator=(const uring &) = delete;
+	~uring();
+	int handle() const noexcept {
+		return fd;
+	}
+	unsigned free_buffers() const noexcept {
+		return free_count;
+	}
+	std::uint8_t * buffer(int id) const noexcept {
+		return buffers + std::size_t(id) * buffer_size;
+	}
+	// Gives the buffer back to the kernel for new recv operations
+	void recycle(int id) noexcept;
+	// False if the entry can't be queued now, try again after completions
+	bool prepare_poll(int target, std::uint32_t events, std::uint64_t data);
+	// Takes a provided buffer, fails with -ENOBUFS if none is free
+	bool prepare_recv(int target, std::uint64_t data);
+	bool prepare_send(int target, const void * bytes, std::size_t length, std::uint64_t data);
+	// Submits queued entries and waits for at least wait completions
+	void submit(unsigned wait);
+	template <typename F>
+	void for_each_completion(F && handler);
+private:
+	bool pop(completion & result) noexcept;
+};
+
+template <typename F>
+void uring::for_each_completion(F && handler) {
+	completion result;
+	while (pop(result))
+		handler(result);
+}
+
+} // namespace mcshub
+
+#endif // _URING_HEAD
@@ -0,0 +1,83 @@
+#include "test.hpp"
+
+#include <thread>
+
+#include "backend_pool.hpp"
+
+test {
+	using namespace mcshub;
+	ekutils::epoll_d poll;
+	hosts_db::mailbox box;
+	ekutils::tcp_listener_d listener;
+	listener.listen("localhost", 0);
+	listener.start();
+
+	settings conf;
+	conf.dns_cache = true;
+	conf.dns_ttl = 60;
+	conf.dns_negative_ttl = 5;
+	auto & record = conf.servers["backend"];
+	record.address = "localhost";
+	record.port = listener.local_endpoint().port();
+	record.pool.min_idle = 2;
+	record.pool.max_idle = 3;
+
+	backend_pool pool(poll);
+	ekutils::tcp_socket_d sock;
+	assert_false(pool.claim(record.address, record.port, record.pool, sock));
+	// The first pass only asks for the backend address
+	pool.maintain(conf, box);
+	hosts_db::answer_t answer;
+	for (int i = 0; i < 50 && !hosts_db::instance().find("localhost", record.port, answer); i++)
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	assert_true(answer != nullptr);
+	pool.maintain(conf, box);
+	for (int i = 0; i < 50 && pool.idle() < 2; i++)
+		poll.wait(100);
+	assert_equals(2u, pool.idle());
+
+	assert_true(pool.claim(record.address, record.port, record.pool, sock));
+	assert_true(sock.is_valid());
+	assert_equals(1u, pool.idle());
+	pool.maintain(conf, box);
+	for (int i = 0; i < 50 && pool.idle() < 2; i++)
+		poll.wait(100);
+	assert_equals(2u, pool.idle());
+
+	// Pool is closed when the record is gone
+	conf.servers.clear();
+	assert_false(pool.empty());
+	pool.maintain(conf, box);
+	assert_equals(0u, pool.idle());
+	assert_true(pool.empty());
+	assert_false(pool.claim(record.address, record.port, record.pool, sock));
+
+	// Without DNS cache the answer goes straight to the pool as in a worker
+	ekutils::tcp_listener_d uncached_listener;
+	uncached_listener.listen("localhost", 0);
+	uncached_listener.start();
+	conf.dns_cache = false;
+	auto & uncached = conf.servers["uncached"];
+	uncached.address = "localhost";
+	uncached.port = uncached_listener.local_endpoint().port();
+	uncached.pool.min_idle = 1;
+	uncached.pool.max_idle = 1;
+	bool resolved = false;
+	poll.add(box, ekutils::actions::in, [&](ekutils::descriptor &, std::uint32_t) {
+		std::vector<hosts_db::completion> taken;
+		box.take(taken);
+		for (const auto & c : taken)
+			pool.on_resolved(c);
+		resolved = resolved || !taken.empty();
+	});
+	pool.maintain(conf, box);
+	for (int i = 0; i < 50 && !resolved; i++)
+		poll.wait(100);
+	assert_true(resolved);
+	assert_false(hosts_db::instance().find("localhost", uncached.port, answer));
+	pool.maintain(conf, box);
+	for (int i = 0; i < 50 && pool.idle() < 1; i++)
+		poll.wait(100);
+	assert_equals(1u, pool.idle());
+	assert_false(hosts_db::instance().find("localhost", uncached.port, answer));
+}
@@ -0,0 +1,109 @@
+#include "test.hpp"
+
+#include <map>
+#include <algorithm>
+
+#include "balancer.hpp"
+
+test {
+	using namespace mcshub;
+	balancer b;
+	settings::basic_record record;
+	record.upstreams = {
+		{ "lobby1", 25565, 3 }, { "lobby2", 25565, 1 }, { "drained", 25565, 0 }
+	};
+
+	// Smooth weighted round robin: 3 to 1 and never the drained one
+	std::map<std::string, int> counts;
+	for (int i = 0; i < 40; i++)
+		counts[b.pick("lobby", record, 1).upstream().address]++;
+	assert_equals(30, counts["lobby1"]);
+	assert_equals(10, counts["lobby2"]);
+	assert_equals(0, counts["drained"]);
+
+	// Least connections respects weights and released leases
+	record.balance = settings::balance_t::least_conn;
+	std::vector<balancer::lease> leases;
+	for (int i = 0; i < 4; i++)
+		leases.push_back(b.pick("lobby", record, 2));
+	counts.clear();
+	for (auto & lease : leases)
+		counts[lease.upstream().address]++;
+	assert_equals(3, counts["lobby1"]);
+	assert_equals(1, counts["lobby2"]);
+	leases.erase(std::remove_if(leases.begin(), leases.end(), [](const balancer::lease & lease) {
+		return lease.upstream().address == "lobby1";
+	}), leases.end());
+	// lobby1 has 0 of 3, lobby2 has 1 of 1
+	assert_equals("lobby1", b.pick("lobby", record, 2).upstream().address);
+
+	// Consistent hash keeps players on their backend
+	record.balance = settings::balance_t::hash;
+	record.upstreams[2].weight = 1;
+	std::map<std::string, std::string> placement;
+	counts.clear();
+	for (int i = 0; i < 200; i++) {
+		std::string nick = "player" + std::to_string(i);
+		placement[nick] = b.pick("lobby", record, 3, nick).upstream().address;
+		counts[placement[nick]]++;
+	}
+	for (auto & [nick, address] : placement)
+		assert_equals(address, b.pick("lobby", record, 3, nick).upstream().address);
+	for (auto & [address, count] : counts)
+		assert_true(count > 10);
+	// Removing a backend moves only its own players
+	settings::basic_record smaller = record;
+	smaller.upstreams.pop_back();
+	for (auto & [nick, address] : placement)
+		if (address != "drained")
+			assert_equals(address, b.pick("lobby", smaller, 4, nick).upstream().address);
+
+	// Filtered upstreams are skipped, hash moves players to the next point
+	auto not_lobby1 = [](const settings::upstream_t & upstream) {
+		return upstream.address != "lobby1";
+	};
+	for (auto & [nick, address] : placement) {
+		std::string chosen = b.pick("lobby", record, 3, nick, not_lobby1).upstream().address;
+		assert_not_equals(std::string("lobby1"), chosen);
+		if (address != "lobby1")
+			assert_equals(address, chosen);
+	}
+	record.balance = settings::balance_t::round_robin;
+	assert_false(bool(b.pick("lobby", record, 3, {}, [](auto &) { return false; })));
+
+	// Record without upstreams uses its own address
+	settings::basic_record single;
+	single.address = "example.org";
+	single.port = 25566;
+	auto lease = b.pick("single", single, 5);
+	assert_equals("example.org", lease.upstream().address);
+	assert_equals(25566, lease.upstream().port);
+
+	// Connections survive a new generation, old leases release them there
+	settings::basic_record before;
+	before.balance = settings::balance_t::least_conn;
+	before.upstreams = { { "first", 25565, 1 }, { "second", 25565, 1 } };
+	auto held = b.pick("survival", before, 6);
+	assert_equals("first", held.upstream().address);
+	settings::basic_record after = before;
+	assert_equals("second", b.pick("survival", after, 7).upstream().address);
+	held = balancer::lease();
+	assert_equals("first", b.pick("survival", after, 7).upstream().address);
+
+	// Records with the same upstreams don't share counters
+	settings::basic_record other = after;
+	auto first = b.pick("creative", other, 8);
+	assert_equals("first", first.upstream().address);
+	held = b.pick("survival", after, 8);
+	assert_equals("first", held.upstream().address);
+	assert_equals("second", b.pick("creative", other, 9).upstream().address);
+	first = balancer::lease();
+	assert_equals("first", b.pick("creative", other, 9).upstream().address);
+	assert_equals("second", b.pick("survival", after, 9).upstream().address);
+
+	// Outdated generations count in the newest one
+	assert_equals("second", b.pick("survival", after, 8).upstream().address);
+	held = balancer::lease();
+	assert_equals("first", b.pick("survival", after, 8).upstream().address);
+	assert_equals("first", b.pick("survival", after, 9).upstream().address);
+}
@@ -0,0 +1,73 @@
+#include "test.hpp"
+
+#include <cstring>
+#include <memory>
+#include <thread>
+
+#include "buffer_pool.hpp"
+
+test {
+	using namespace mcshub;
+	buffer_pool & pool = buffer_pool::local();
+	const byte_t text[] = "status request";
+	const std::size_t text_sz = sizeof(text) - 1;
+	{
+		io_buffer buff;
+		assert_false(buff.holds_memory());
+		buff.append(text, text_sz);
+		assert_true(buff.holds_memory());
+		assert_equals(text_sz, buff.size());
+		assert_true(!std::memcmp(text, buff.data(), text_sz));
+		buff.move(7);
+		assert_equals(text_sz - 7, buff.size());
+		assert_true(!std::memcmp(text + 7, buff.data(), text_sz - 7));
+		buff.move(text_sz - 7);
+		// Drained buffer gives its slab back
+		assert_false(buff.holds_memory());
+		assert_equals(1u, pool.cached());
+	}
+	std::size_t allocs = 0;
+	for (int i = 0; i < 100; i++) {
+		io_buffer input, output;
+		input.asize(100);
+		std::memset(input.data(), i, 100);
+		output.append(input.data(), input.size());
+		input.clear();
+		output.ssize(output.size());
+		if (i == 0)
+			allocs = pool.allocations();
+	}
+	// Short connections reuse cached slabs
+	assert_equals(allocs, pool.allocations());
+	{
+		io_buffer buff;
+		for (std::size_t i = 0; i < 100000; i++) {
+			byte_t b = static_cast<byte_t>(i);
+			buff.append(&b, 1);
+		}
+		assert_equals(100000u, buff.size());
+		buff.move(99990);
+		for (std::size_t i = 0; i < 10; i++)
+			assert_equals(int(static_cast<byte_t>(99990 + i)), int(buff.data()[i]));
+		buff.asize(4000);
+		assert_equals(4010u, buff.size());
+		for (std::size_t i = 0; i < 10; i++)
+			assert_equals(int(static_cast<byte_t>(99990 + i)), int(buff.data()[i]));
+	}
+
+	// Slab released by another thread comes back to this pool
+	std::size_t before = pool.cached();
+	auto handed = std::make_unique<io_buffer>();
+	handed->append(text, text_sz);
+	assert_equals(before - 1, pool.cached());
+	std::thread([&handed]() {
+		handed.reset();
+		assert_equals(0u, buffer_pool::local().cached());
+	}).join();
+	allocs = pool.allocations();
+	io_buffer again;
+	again.append(text, text_sz);
+	assert_equals(allocs, pool.allocations());
+	again.clear();
+	assert_equals(before, pool.cached());
+}
@@ -0,0 +1,42 @@
+#include <thread>
+
+#include "test_server.hpp"
+#include "test.hpp"
+
+// Registered readers keep their configuration snapshot across reloads
+// until the next quiescent point, unregistered threads see a new one
+// right away
+
+unsigned long unregistered_generation() {
+	unsigned long generation = 0;
+	std::thread reader([&generation]() {
+		generation = mcshub::conf_reader::get().generation;
+	});
+	reader.join();
+	return generation;
+}
+
+test {
+	using namespace mcshub;
+	auto dir = confset::create();
+	assert_equals(0, chdir(dir->path.c_str()));
+	settings::initialize();
+	conf_reader reader;
+	const settings & before = conf_reader::get();
+	std::weak_ptr<const settings> snapshot = conf_reader::snapshot();
+	unsigned long generation = before.generation;
+	assert_equals(generation, unregistered_generation());
+
+	reload_configuration();
+	assert_equals(generation + 1, unregistered_generation());
+	// Old snapshot is still in use by this thread
+	assert_true(&conf_reader::get() == &before);
+	assert_equals(generation, conf_reader::get().generation);
+	assert_false(snapshot.expired());
+	assert_true(conf_reader::snapshot().get() == &before);
+
+	conf_reader::quiescent();
+	assert_equals(generation + 1, conf_reader::get().generation);
+	assert_true(snapshot.expired());
+	assert_equals(0, chdir(".."));
+}
@@ -0,0 +1,42 @@
+#include <thread>
+
+#include "test_server.hpp"
+#include "test.hpp"
+
+// Player of a refused backend gets the fake login even if the login
+// packet comes later than the backend connection timeout
+
+test {
+	using namespace mcshub;
+	using namespace std::chrono_literals;
+	std::uint16_t refused_port;
+	{
+		ekutils::tcp_listener_d closed;
+		closed.listen("127.0.0.1", 0);
+		refused_port = closed.local_endpoint().port();
+	}
+	auto dir = confset::create();
+	settings conf;
+	conf.timeout = 300;
+	auto & record = conf.servers["refused"];
+	record.address = "127.0.0.1";
+	record.port = refused_port;
+	dir->mk_config(conf);
+	mcshub::mcshub server(dir, ekutils::stream::in | ekutils::stream::err);
+
+	sclient client("localhost", server.port());
+	client.set_timeout(10s);
+	pakets::handshake hs;
+	hs.version() = 578;
+	hs.address() = "refused";
+	hs.port() = server.port();
+	hs.state() = 2;
+	client.write_paket(hs);
+	std::this_thread::sleep_for(600ms);
+	pakets::login login;
+	login.name() = "slow";
+	client.write_paket(login);
+	pakets::disconnect ds;
+	client.read_paket(ds);
+	assert_false(ds.message().empty());
+}
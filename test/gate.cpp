@@ -0,0 +1,54 @@
+#include <thread>
+#include <vector>
+
+#include "client.hpp"
+
+#include "test.hpp"
+
+// Reads until the gate has received size bytes in total
+void receive_all(mcshub::gate & gate, std::size_t size) {
+	for (int attempt = 0; gate.avail_read() < size && attempt < 1000; attempt++) {
+		gate.receive();
+		if (gate.avail_read() < size)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	assert_equals(size, gate.avail_read());
+}
+
+test {
+	using namespace mcshub;
+	ekutils::tcp_listener_d listener;
+	listener.listen("127.0.0.1", 0);
+	listener.start();
+	ekutils::tcp_socket_d client(ekutils::connection_info::resolve("127.0.0.1", listener.local_endpoint().port()));
+	gate server(listener.accept());
+	server.sock.set_non_block();
+	assert_equals(gate::min_read_chunk, server.read_size());
+
+	// Bulk transfer makes the read chunk grow
+	std::vector<ekutils::byte_t> bulk(65536, 'b');
+	auto events = gate::receive_events.load(), reads = gate::read_calls.load();
+	assert_equals(int(bulk.size()), client.write(bulk.data(), bulk.size()));
+	receive_all(server, bulk.size());
+	assert_true(server.read_size() > gate::min_read_chunk);
+	assert_true(gate::receive_events > events);
+	assert_true(gate::read_calls - reads > gate::receive_events - events);
+	assert_equals(gate::read_calls - gate::receive_events, gate::extra_reads());
+
+	// Small messages make it shrink back
+	std::size_t total = bulk.size();
+	std::vector<ekutils::byte_t> message(100, 'm');
+	for (int i = 0; i < 8; i++) {
+		assert_equals(int(message.size()), client.write(message.data(), message.size()));
+		total += message.size();
+		receive_all(server, total);
+	}
+	assert_equals(gate::min_read_chunk, server.read_size());
+
+	// Event without bytes is one read
+	events = gate::receive_events;
+	reads = gate::read_calls;
+	server.receive();
+	assert_equals(events + 1, gate::receive_events.load());
+	assert_equals(reads + 1, gate::read_calls.load());
+}
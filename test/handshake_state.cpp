@@ -0,0 +1,61 @@
+#include <thread>
+
+#include "test_server.hpp"
+#include "test.hpp"
+
+// Handshake state is released when a tunnel becomes stable, connections
+// that haven't finished the handshake keep it
+
+template <typename S>
+void await_states(S & server, unsigned long long expected) {
+	unsigned long long states = 0;
+	for (int attempt = 0; attempt < 100; attempt++) {
+		if ((states = server.io_counter("handshake states")) == expected)
+			break;
+		std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	}
+	assert_equals(expected, states);
+}
+
+test {
+	using namespace mcshub;
+	echo_backend backend;
+	auto dir = confset::create();
+	settings conf;
+	auto & record = conf.servers["echo"];
+	record.address = "127.0.0.1";
+	record.port = backend.port();
+	dir->mk_config(conf);
+	mcshub::mcshub server(dir, ekutils::stream::in | ekutils::stream::err);
+	await_states(server, 0);
+
+	// Only the length of the handshake packet is sent
+	ekutils::tcp_socket_d partial(ekutils::connection_info::resolve("localhost", server.port()));
+	const ekutils::byte_t length = 20;
+	assert_equals(1, partial.write(&length, 1));
+	await_states(server, 1);
+
+	sclient client("localhost", server.port());
+	client.set_timeout(std::chrono::seconds(10));
+	pakets::handshake hs;
+	hs.version() = 578;
+	hs.address() = "echo";
+	hs.port() = server.port();
+	hs.state() = 2;
+	client.write_paket(hs);
+	pakets::login login;
+	login.name() = "stable";
+	client.write_paket(login);
+	client.read_paket(hs);
+	client.read_paket(login);
+	pakets::response payload, echoed;
+	payload.message() = "after login";
+	client.write_paket(payload);
+	client.read_paket(echoed);
+	assert_equals(payload.message(), echoed.message());
+	// Tunnel is stable, only the partial handshake holds its state
+	await_states(server, 1);
+
+	partial.close();
+	await_states(server, 0);
+}
@@ -0,0 +1,74 @@
+#include "test_server.hpp"
+#include "test.hpp"
+
+#include "health.hpp"
+#include "sclient.hpp"
+
+test {
+	using namespace mcshub;
+	using namespace std::chrono_literals;
+	mcshub::mcshub server(ekutils::stream::in | ekutils::stream::err);
+
+	// Hub answers status requests itself
+	std::string message;
+	auto latency = health_checker::check("localhost", server.port(), 1000ms, &message);
+	assert_true(latency < 1000ms);
+	assert_true(message.find("\"version\"") != std::string::npos);
+
+	// Backend that accepts connections but never answers
+	ekutils::tcp_listener_d silent;
+	silent.listen("localhost", 0);
+	silent.start();
+	auto start = std::chrono::steady_clock::now();
+	assert_fails({ health_checker::check("localhost", silent.local_endpoint().port(), 200ms); });
+	assert_true(std::chrono::steady_clock::now() - start < 1000ms);
+
+	// Unknown backends are never down
+	assert_false(health_checker::instance().is_down("localhost", server.port()));
+	assert_true(health_checker::instance().report().empty());
+	assert_true(health_checker::instance().live_status("localhost", server.port(), 1000ms) == nullptr);
+
+	// Portals look backends up in the published view
+	health_checker::view_t view;
+	view.backends = {
+		{ "lobby", 25565, false, nullptr, {} }, { "survival", 25565, true, nullptr, {} }, { "lobby", 25566, true, nullptr, {} }
+	};
+	assert_true(view.find("survival", 25565)->down);
+	assert_false(view.find("lobby", 25565)->down);
+	assert_true(view.find("lobby", 25566)->down);
+	assert_true(view.find("creative", 25565) == nullptr);
+	assert_true(view.find("lobby", 25567) == nullptr);
+
+	// Probes and sclient read the same status exchange
+	auto request = sclient::status_request("lobby", 25565);
+	pakets::handshake hs;
+	assert_equals(0u, sclient::parse_paket(request.data(), 3, hs));
+	std::size_t first = sclient::parse_paket(request.data(), request.size(), hs);
+	assert_equals("lobby", hs.address());
+	assert_equals(1, hs.state());
+	pakets::request req;
+	assert_equals(request.size() - first, sclient::parse_paket(request.data() + first, request.size() - first, req));
+	const ekutils::byte_t malformed[] = { 2, 0, 5 };
+	pakets::response response;
+	assert_fails({ sclient::parse_paket(malformed, sizeof(malformed), response); });
+
+	// Players of several backends are summed up
+	health_checker::players_t lobby, survival, broken;
+	assert_true(health_checker::parse_players(message, lobby));
+	assert_true(health_checker::parse_players(R"({"players":{"online":3,"max":20,"sample":[)"
+		R"({"name":"Ktlo","id":"7a4c"},{"name":"q\"t","id":"1"}]}})", survival));
+	assert_equals(3, survival.online);
+	assert_equals(2u, survival.sample.size());
+	assert_equals("q\"t", survival.sample[1].first);
+	assert_false(health_checker::parse_players("{\"description\":\"\"}", broken));
+	assert_false(health_checker::parse_players("{ not a json", broken));
+	aggregate_status sum = health_checker::merge({ &lobby, &survival }, 3);
+	assert_equals(lobby.online + 3, sum.online);
+	assert_equals(lobby.max + 20, sum.max);
+	assert_equals(2u, sum.live);
+	assert_equals(3u, sum.total);
+	assert_true(sum.sample.find(R"({"name":"q\"t","id":"1"})") != std::string::npos);
+	assert_equals("[]", health_checker::merge({}, 2).sample);
+	assert_true(health_checker::instance().aggregate("unknown", 0) == nullptr);
+	assert_true(health_checker::record_name("lobby", false) != health_checker::record_name("lobby", true));
+}
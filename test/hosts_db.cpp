@@ -0,0 +1,59 @@
+#include "test.hpp"
+
+#include <chrono>
+
+#include <ekutils/epoll_d.hpp>
+
+#include "hosts_db.hpp"
+
+test {
+	using namespace mcshub;
+	using std::chrono::seconds;
+	hosts_db db;
+	hosts_db::mailbox box;
+	ekutils::epoll_d poll;
+	std::vector<hosts_db::completion> answers;
+	poll.add(box, ekutils::actions::in, [&](ekutils::descriptor &, std::uint32_t) {
+		std::vector<hosts_db::completion> taken;
+		box.take(taken);
+		for (auto & c : taken)
+			answers.push_back(std::move(c));
+	});
+	auto wait_answers = [&](std::size_t count) {
+		for (int i = 0; i < 50 && answers.size() < count; i++)
+			poll.wait(100);
+	};
+
+	hosts_db::answer_t answer;
+	assert_false(db.find("localhost", 25565, answer));
+	// Requests for the same name are merged
+	db.resolve("localhost", 25565, { seconds(60), seconds(5) }, box, { 1, 0 });
+	db.resolve("localhost", 25565, { seconds(60), seconds(5) }, box, { 2, 0 });
+	wait_answers(2);
+	assert_equals(2u, answers.size());
+	assert_true(answers[0].answer != nullptr);
+	assert_true(answers[0].answer == answers[1].answer);
+	assert_true(db.find("localhost", 25565, answer));
+	assert_true(answer == answers[0].answer);
+	assert_equals(1u, db.size());
+
+	// Zero TTL disables caching
+	answers.clear();
+	db.resolve("localhost", 25566, { seconds(0), seconds(0) }, box, { 3, 0 });
+	wait_answers(1);
+	assert_equals(1u, answers.size());
+	assert_equals(3u, answers[0].client.index);
+	assert_false(db.find("localhost", 25566, answer));
+
+	// Different names don't wait for each other
+	answers.clear();
+	for (std::uint32_t i = 0; i < 8; i++)
+		db.resolve("localhost", std::uint16_t(26000 + i), { seconds(60), seconds(5) }, box, { i, 0 });
+	wait_answers(8);
+	assert_equals(8u, answers.size());
+	assert_true(db.thread_count() >= 1);
+	assert_true(db.thread_count() <= hosts_db::max_threads);
+
+	db.clear();
+	assert_equals(0u, db.size());
+}
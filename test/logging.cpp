@@ -0,0 +1,123 @@
+#include "test.hpp"
+
+#include <filesystem>
+#include <stdexcept>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include "logging.hpp"
+#include "log_sink.hpp"
+
+namespace fs = std::filesystem;
+
+test {
+	using namespace mcshub;
+	using ekutils::log_level;
+	int formatted = 0;
+	auto format = [&formatted](const std::string & text) {
+		formatted++;
+		return text;
+	};
+
+	set_log_threshold(log_level::info);
+	assert_true(log_enabled(log_level::error));
+	assert_true(log_enabled(log_level::info));
+	assert_false(log_enabled(log_level::verbose));
+	assert_false(log_enabled(log_level::debug));
+
+	// Disabled messages are not even formatted
+	lazy_debug(format("client #" + std::to_string(1)));
+	lazy_verbose(format("verbose"));
+	assert_equals(0, formatted);
+
+	// Lines of several threads end up in the file
+	fs::path path = fs::temp_directory_path() / ("mcshub-log-" + std::to_string(::getpid()));
+	fs::remove(path);
+	log_sink & sink = log_sink::instance();
+	sink.start(path);
+	assert_true(sink.active());
+	lazy_info(format("main thread"));
+	assert_equals(1, formatted);
+	constexpr int threads = 4, lines = 500;
+	std::vector<std::thread> workers;
+	for (int t = 0; t < threads; t++) {
+		workers.emplace_back([t]() {
+			for (int i = 0; i < lines; i++)
+				lazy_info("worker " + std::to_string(t) + " line " + std::to_string(i));
+			lazy_error(std::runtime_error("worker " + std::to_string(t) + " failed"));
+		});
+	}
+	for (auto & worker : workers)
+		worker.join();
+	sink.stop();
+	assert_false(sink.active());
+	std::ifstream file(path);
+	std::string line;
+	int count = 0, errors = 0;
+	bool ordered = true;
+	std::vector<int> next(threads, 0);
+	while (std::getline(file, line)) {
+		count++;
+		if (line.find("[error] worker ") != std::string::npos)
+			errors++;
+		for (int t = 0; t < threads; t++) {
+			std::string prefix = "] worker " + std::to_string(t) + " line ";
+			auto pos = line.find(prefix);
+			if (pos != std::string::npos) {
+				// Lines of one thread keep their order
+				ordered = ordered && std::stoi(line.substr(pos + prefix.size())) == next[t];
+				next[t]++;
+			}
+		}
+	}
+	assert_true(ordered);
+	assert_equals(std::uint64_t(0), sink.dropped());
+	assert_equals(1 + threads * lines + threads, count);
+	assert_equals(threads, errors);
+	fs::remove(path);
+
+	// Full ring drops lines instead of blocking
+	log_sink::ring small(3);
+	assert_equals(4u, small.capacity());
+	for (int i = 0; i < 6; i++)
+		small.push(log_level::info, "line " + std::to_string(i));
+	assert_equals(4u, small.size());
+	assert_equals(std::uint64_t(2), small.dropped());
+	std::string batch;
+	assert_equals(4u, small.drain([&batch](const log_sink::entry & e) {
+		log_sink::format(batch, e);
+	}));
+	assert_true(batch.find("[info] line 3\n") != std::string::npos);
+	assert_true(batch.find("line 4") == std::string::npos);
+	assert_true(small.push(log_level::info, "again"));
+	assert_equals(1u, small.size());
+
+	// Stopped sink gives lines back to the caller
+	assert_false(sink.push(log_level::info, "nobody"));
+
+	// Every line taken while the sink stops is written
+	sink.start(path);
+	std::uint64_t drops_before = sink.dropped(), drops_after = 0;
+	std::size_t taken = 0;
+	std::thread racer([&]() {
+		while (sink.push(log_level::info, "race line " + std::to_string(taken)))
+			taken++;
+		// Ring of the thread is counted only while the thread lives
+		drops_after = sink.dropped();
+	});
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	sink.stop();
+	racer.join();
+	std::ifstream raced(path);
+	std::size_t written = 0;
+	while (std::getline(raced, line))
+		if (line.find("] race line ") != std::string::npos)
+			written++;
+	assert_true(taken > 0);
+	assert_equals(std::uint64_t(taken), written + (drops_after - drops_before));
+	fs::remove(path);
+}
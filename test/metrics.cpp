@@ -0,0 +1,75 @@
+#include "test.hpp"
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "metrics.hpp"
+
+test {
+	using namespace mcshub;
+	using counter_t = metrics::counter_t;
+	const auto base = metrics::collect();
+
+	// Every thread writes its own shard, scrapes see the sum
+	constexpr int threads = 4, rounds = 10000;
+	std::vector<std::thread> workers;
+	for (int t = 0; t < threads; t++) {
+		workers.emplace_back([]() {
+			metrics::shard & stats = metrics::local();
+			for (int i = 0; i < rounds; i++) {
+				stats.add(counter_t::accepts);
+				stats.add(counter_t::bytes_upstream, 10);
+			}
+			stats.add(counter_t::closes, rounds);
+		});
+	}
+	for (auto & worker : workers)
+		worker.join();
+	auto data = metrics::collect();
+	assert_equals(base[counter_t::accepts] + threads * rounds, data[counter_t::accepts]);
+	assert_equals(base[counter_t::bytes_upstream] + 10 * threads * rounds, data[counter_t::bytes_upstream]);
+	assert_equals(base[counter_t::closes] + threads * rounds, data[counter_t::closes]);
+
+	// Shard of a thread stays the same
+	assert_true(&metrics::local() == &metrics::local());
+
+	// Latencies go to the first bucket that holds them
+	metrics::shard & stats = metrics::local();
+	using std::chrono::microseconds;
+	stats.observe(metrics::histogram_t::backend_latency, microseconds(500));
+	stats.observe(metrics::histogram_t::backend_latency, microseconds(1000));
+	stats.observe(metrics::histogram_t::backend_latency, microseconds(30000));
+	stats.observe(metrics::histogram_t::backend_latency, microseconds(60000000));
+	data = metrics::collect();
+	const auto & hist = data.latencies[std::size_t(metrics::histogram_t::backend_latency)];
+	assert_equals(std::uint64_t(2), hist.buckets[0]);
+	assert_equals(std::uint64_t(1), hist.buckets[5]);
+	assert_equals(std::uint64_t(1), hist.buckets[metrics::bounds.size()]);
+	assert_equals(std::uint64_t(4), hist.count);
+	assert_equals(std::uint64_t(60031500), hist.sum);
+
+	// Prometheus text format
+	metrics::snapshot sample;
+	sample.values[std::size_t(counter_t::accepts)] = 7;
+	sample.values[std::size_t(counter_t::closes)] = 5;
+	sample.values[std::size_t(counter_t::status_fake)] = 3;
+	sample.latencies[0].buckets[1] = 2;
+	sample.latencies[0].buckets[metrics::bounds.size()] = 1;
+	sample.latencies[0].sum = 6003000;
+	sample.latencies[0].count = 3;
+	std::string text = metrics::render(sample);
+	assert_true(text.find("# TYPE mcshub_accepted_connections_total counter\nmcshub_accepted_connections_total 7\n") != std::string::npos);
+	assert_true(text.find("mcshub_status_responses_total{source=\"fake\"} 3\n") != std::string::npos);
+	assert_true(text.find("mcshub_active_connections 2\n") != std::string::npos);
+	assert_true(text.find("mcshub_backend_latency_seconds_bucket{le=\"0.001\"} 0\n") != std::string::npos);
+	assert_true(text.find("mcshub_backend_latency_seconds_bucket{le=\"0.002\"} 2\n") != std::string::npos);
+	assert_true(text.find("mcshub_backend_latency_seconds_bucket{le=\"5\"} 2\n") != std::string::npos);
+	assert_true(text.find("mcshub_backend_latency_seconds_bucket{le=\"+Inf\"} 3\n") != std::string::npos);
+	assert_true(text.find("mcshub_backend_latency_seconds_sum 6.003\n") != std::string::npos);
+	assert_true(text.find("mcshub_backend_latency_seconds_count 3\n") != std::string::npos);
+	// One TYPE line per family
+	std::size_t first = text.find("# TYPE mcshub_timeouts_total");
+	assert_true(first != std::string::npos);
+	assert_true(text.find("# TYPE mcshub_timeouts_total", first + 1) == std::string::npos);
+}
@@ -0,0 +1,82 @@
+#include "test.hpp"
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "record_stats.hpp"
+#include "settings.hpp"
+
+test {
+	using namespace mcshub;
+	using counter_t = record_stats::counter_t;
+	settings conf;
+	conf.servers["lobby"];
+	conf.servers["survival"];
+
+	// Threads write their own slots of a record, the sum is reported
+	constexpr int threads = 4, rounds = 1000;
+	std::vector<std::thread> workers;
+	for (int t = 0; t < threads; t++) {
+		workers.emplace_back([]() {
+			for (int i = 0; i < rounds; i++) {
+				record_stats::slot & lobby = record_stats::local("lobby");
+				lobby.add(counter_t::status_requests);
+				lobby.add(counter_t::bytes_out, 100);
+			}
+			record_stats::slot & survival = record_stats::local("survival");
+			survival.add(counter_t::tunnels_opened, 3);
+			survival.add(counter_t::tunnels_closed, 1);
+			survival.observe(std::chrono::milliseconds(20));
+		});
+	}
+	for (auto & worker : workers)
+		worker.join();
+	assert_true(&record_stats::local("lobby") == &record_stats::local("lobby"));
+	assert_false(&record_stats::local("lobby") == &record_stats::local("survival"));
+
+	record_stats::summary lobby;
+	assert_true(record_stats::collect(conf, "lobby", lobby));
+	assert_equals(std::uint64_t(threads * rounds), lobby[counter_t::status_requests]);
+	assert_equals(std::uint64_t(100 * threads * rounds), lobby[counter_t::bytes_out]);
+	assert_equals(std::uint64_t(0), lobby.active());
+	record_stats::summary survival;
+	assert_true(record_stats::collect(conf, "survival", survival));
+	assert_equals(std::uint64_t(2 * threads), survival.active());
+	assert_equals(std::uint64_t(threads), survival.latency.count);
+
+	// Percentiles are interpolated inside the bucket of 10..25 ms
+	double median = metrics::quantile(survival.latency, 0.5);
+	assert_true(median > 10000 && median <= 25000);
+	std::string text = record_stats::describe(survival);
+	assert_true(text.find("active tunnels: 8\n") != std::string::npos);
+	assert_true(text.find("connect latency: p50 ") != std::string::npos);
+	assert_true(record_stats::describe(lobby).find("no connections") != std::string::npos);
+
+	// Records removed from the configuration are not reported, the rest
+	// keep their numbers
+	conf.servers.erase("lobby");
+	record_stats::summary removed;
+	assert_false(record_stats::collect(conf, "lobby", removed));
+	assert_false(record_stats::collect(conf, "unknown", removed));
+	auto records = record_stats::collect(conf);
+	assert_equals(1u, records.size());
+	assert_equals(std::string("survival"), records[0].name);
+	conf.servers["lobby"];
+	assert_true(record_stats::collect(conf, "lobby", removed));
+	assert_equals(std::uint64_t(threads * rounds), removed[counter_t::status_requests]);
+
+	// Default record is known by its special name
+	record_stats::local(record_stats::default_name).add(counter_t::fake_logins);
+	record_stats::summary fallback;
+	assert_true(record_stats::collect(conf, record_stats::default_name, fallback));
+	assert_equals(std::uint64_t(1), fallback[counter_t::fake_logins]);
+
+	// Prometheus text with the record label
+	text = record_stats::render(record_stats::collect(conf));
+	assert_true(text.find("mcshub_record_handshakes_total{record=\"lobby\",state=\"status\"} 4000\n") != std::string::npos);
+	assert_true(text.find("mcshub_record_active_tunnels{record=\"survival\"} 8\n") != std::string::npos);
+	assert_true(text.find("mcshub_record_backend_latency_seconds_bucket{record=\"survival\",le=\"0.025\"} 4\n") != std::string::npos);
+	assert_true(text.find("mcshub_record_backend_latency_seconds_count{record=\"survival\"} 4\n") != std::string::npos);
+	assert_true(text.find("mcshub_record_fake_logins_total{record=\"$default\"} 1\n") != std::string::npos);
+}
@@ -0,0 +1,89 @@
+#include "test.hpp"
+
+#include <string>
+#include <unordered_map>
+#include <type_traits>
+
+#include "route_table.hpp"
+#include "settings.hpp"
+#include "record_route.hpp"
+
+test {
+	using namespace mcshub;
+	std::unordered_map<std::string, int> records = {
+		{ "lobby", 1 }, { "survival", 2 }, { "creative", 3 }, { "", 4 }
+	};
+	int fallback = 0;
+	route_table<int> routes;
+	assert_true(routes.empty());
+	routes.build(records, fallback, ".mc.example.com");
+	assert_false(routes.empty());
+
+	auto route = routes.find("lobby.mc.example.com");
+	assert_equals(1, *route.record);
+	assert_equals("lobby", std::string(route.name));
+	assert_false(route.fml);
+
+	// Trailing dot of a fully qualified name
+	route = routes.find("survival.mc.example.com.");
+	assert_equals(2, *route.record);
+	assert_equals("survival", std::string(route.name));
+
+	// Forge clients append "\0FML\0" to the address
+	const std::string forge("creative.mc.example.com\0FML\0", 28);
+	route = routes.find(forge);
+	assert_equals(3, *route.record);
+	assert_equals("creative", std::string(route.name));
+	assert_true(route.fml);
+
+	// Names outside of the domain are looked up as is
+	route = routes.find("lobby");
+	assert_equals(1, *route.record);
+	route = routes.find("mc.example.com");
+	assert_true(route.record == &fallback);
+	assert_equals("mc.example.com", std::string(route.name));
+
+	route = routes.find("unknown.mc.example.com");
+	assert_true(route.record == &fallback);
+	assert_equals("unknown", std::string(route.name));
+
+	// Tables can't be copied, copies of settings share the table until
+	// they build their own
+	static_assert(!std::is_copy_constructible_v<route_table<int>>);
+	static_assert(!std::is_copy_assignable_v<route_table<int>>);
+	settings conf;
+	conf.servers["lobby"].port = 25565;
+	assert_true(conf.routes == nullptr);
+	conf.build_routes();
+	assert_true(conf.routes->find("lobby").record == &conf.servers["lobby"]);
+	settings copy = conf;
+	assert_true(copy.routes == conf.routes);
+	copy.build_routes();
+	assert_true(copy.routes != conf.routes);
+	assert_true(copy.routes->find("lobby").record == &copy.servers["lobby"]);
+	assert_true(conf.routes->find("lobby").record == &conf.servers["lobby"]);
+
+	// Record of a handshake with its statistics slot
+	conf.servers["lobby"].fml = settings::basic_record();
+	conf.build_routes();
+	std::string server_name;
+	auto lobby = route_record(*conf.routes, conf.default_server, std::string("lobby\0FML\0", 10), server_name);
+	assert_equals("lobby", server_name);
+	assert_true(&lobby.record == &*conf.servers["lobby"].fml);
+	assert_true(lobby.fml);
+	assert_equals("lobby", lobby.stats_name);
+	assert_true(&lobby.stats == &record_stats::local("lobby"));
+	auto unknown = route_record(*conf.routes, conf.default_server, "unknown", server_name);
+	assert_equals("unknown", server_name);
+	assert_true(&unknown.record == &conf.default_server);
+	assert_false(unknown.fml);
+	assert_equals(record_stats::default_name, unknown.stats_name);
+
+	std::unordered_map<std::string, int> many;
+	for (int i = 0; i < 1000; i++)
+		many["server" + std::to_string(i)] = i;
+	routes.build(many, fallback, "");
+	for (int i = 0; i < 1000; i++)
+		assert_equals(i, *routes.find("server" + std::to_string(i)).record);
+	assert_true(routes.find("server1000").record == &fallback);
+}
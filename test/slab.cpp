@@ -0,0 +1,53 @@
+#include "test.hpp"
+
+#include <string>
+
+#include "slab.hpp"
+
+struct tracked {
+	static int alive;
+	std::string name;
+	explicit tracked(const std::string & n) : name(n) {
+		alive++;
+	}
+	~tracked() {
+		alive--;
+	}
+};
+
+int tracked::alive = 0;
+
+test {
+	using namespace mcshub;
+	{
+		slab<tracked, 4> objects;
+		std::vector<slab_handle> handles;
+		for (int i = 0; i < 10; i++)
+			handles.push_back(objects.emplace("object #" + std::to_string(i)));
+		assert_equals(10, tracked::alive);
+		assert_equals(10u, objects.size());
+		tracked * third = objects.get(handles[3]);
+		assert_equals("object #3", third->name);
+		for (int i = 10; i < 20; i++)
+			objects.emplace("object #" + std::to_string(i));
+		// Addresses are stable while the slab grows
+		assert_true(third == objects.get(handles[3]));
+		assert_true(objects.erase(handles[3]));
+		assert_false(objects.erase(handles[3]));
+		assert_true(objects.get(handles[3]) == nullptr);
+		assert_equals(19, tracked::alive);
+		// Slot is reused, but the old handle stays invalid
+		slab_handle reused = objects.emplace("reused");
+		assert_equals(handles[3].index, reused.index);
+		assert_not_equals(handles[3].generation, reused.generation);
+		assert_true(objects.get(handles[3]) == nullptr);
+		assert_equals("reused", objects.get(reused)->name);
+		std::size_t visited = 0;
+		objects.for_each([&visited](tracked &) {
+			visited++;
+		});
+		assert_equals(20u, visited);
+		assert_true(objects.get(slab_handle()) == nullptr);
+	}
+	assert_equals(0, tracked::alive);
+}
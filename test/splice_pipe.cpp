@@ -0,0 +1,53 @@
+#include "test.hpp"
+
+#include <string>
+
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "splice_pipe.hpp"
+
+test {
+	using namespace mcshub;
+	int from[2], to[2];
+	assert_equals(0, socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, from));
+	assert_equals(0, socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, to));
+	splice_pipe pipe;
+	assert_false(pipe.is_open());
+	assert_true(pipe.open());
+	assert_true(pipe.fill(from[1]) == splice_pipe::result::again);
+
+	// socket -> pipe -> socket
+	const std::string message = "spliced bytes";
+	assert_equals(long(message.size()), long(::write(from[0], message.data(), message.size())));
+	assert_true(pipe.fill(from[1]) == splice_pipe::result::done);
+	assert_equals(message.size(), pipe.avail());
+	assert_true(pipe.drain(to[0]) == splice_pipe::result::done);
+	assert_equals(0u, pipe.avail());
+	char received[64];
+	long got = long(::read(to[1], received, sizeof(received)));
+	assert_equals(message, std::string(received, got < 0 ? 0 : std::size_t(got)));
+
+	// Bytes stay in the pipe while the peer can't take them
+	std::string chunk(4096, 'x');
+	while (::write(to[0], chunk.data(), chunk.size()) > 0);
+	assert_equals(long(message.size()), long(::write(from[0], message.data(), message.size())));
+	assert_true(pipe.fill(from[1]) == splice_pipe::result::done);
+	assert_true(pipe.drain(to[0]) == splice_pipe::result::again);
+	assert_equals(message.size(), pipe.avail());
+
+	// Descriptors without splice support make the gate fall back to
+	// buffered forwarding, unless some bytes are already in the pipe
+	int event = eventfd(1, EFD_NONBLOCK);
+	assert_fails({ pipe.fill(event); });
+	pipe.close();
+	assert_false(pipe.is_open());
+	assert_true(pipe.open());
+	assert_true(pipe.fill(event) == splice_pipe::result::unsupported);
+	assert_equals(0u, pipe.avail());
+
+	::close(event);
+	for (int fd : { from[0], from[1], to[0], to[1] })
+		::close(fd);
+}
@@ -0,0 +1,87 @@
+#include "status_cache.hpp"
+
+#include "test.hpp"
+
+std::string message_of(const mcshub::status_cache::frame_t & frame) {
+	mcshub::pakets::response response;
+	response.read(frame.data(), frame.size());
+	return response.message();
+}
+
+test {
+	using namespace mcshub;
+	status_cache cache;
+	settings::basic_record first, second;
+	assert_true(cache.usable(1));
+	assert_true(cache.find(&first) == nullptr);
+
+	// Frames of one record are kept apart by what the template reads
+	auto & plain = cache.insert(&first, compiled_template(), false, false);
+	assert_true(cache.find(&first) == &plain);
+	assert_true(cache.find(&second) == nullptr);
+	pakets::handshake hs;
+	hs.version() = 578;
+	hs.address() = "a.example";
+	hs.port() = 25565;
+	assert_equals("", status_cache::frame_key(plain, hs));
+	auto & shaken = cache.insert(&second, compiled_template(), false, true);
+	std::string key = status_cache::frame_key(shaken, hs);
+	hs.version() = 579;
+	assert_true(key != status_cache::frame_key(shaken, hs));
+	hs.address() = "b.example";
+	assert_true(status_cache::frame_key(shaken, hs) != status_cache::frame_key(plain, hs));
+
+	// Default record serves different frames to different addresses
+	hs.address() = "a.example";
+	const auto & frame_a = cache.store(shaken, status_cache::frame_key(shaken, hs), "server a");
+	assert_equals("server a", message_of(frame_a));
+	hs.address() = "b.example";
+	assert_true(cache.find_frame(shaken, status_cache::frame_key(shaken, hs)) == nullptr);
+	cache.store(shaken, status_cache::frame_key(shaken, hs), "server b");
+	assert_equals("server b", message_of(*cache.find_frame(shaken, status_cache::frame_key(shaken, hs))));
+	hs.address() = "a.example";
+	assert_equals("server a", message_of(*cache.find_frame(shaken, status_cache::frame_key(shaken, hs))));
+
+	// Frames belong to a revision of the aggregated status
+	cache.store(plain, "", "revision 0");
+	cache.renew(plain, 0);
+	assert_true(cache.find_frame(plain, "") != nullptr);
+	cache.renew(plain, 1);
+	assert_true(cache.find_frame(plain, "") == nullptr);
+
+	// Too many frames drop all of them
+	for (std::size_t i = 0; i < status_cache::max_frames; i++)
+		cache.store(plain, std::to_string(i), "frame");
+	assert_true(cache.find_frame(shaken, status_cache::frame_key(shaken, hs)) == nullptr);
+	assert_true(cache.find_frame(plain, std::to_string(status_cache::max_frames - 1)) != nullptr);
+
+	// Outdated snapshots don't use the cache, a new one drops it
+	assert_false(cache.usable(0));
+	assert_true(cache.find(&first) != nullptr);
+	assert_true(cache.usable(2));
+	assert_true(cache.find(&first) == nullptr);
+
+	// Compiled templates are kept for the recent generations
+	using kind = status_cache::template_t;
+	assert_true(cache.find_template(2, kind::login, &first) == nullptr);
+	const auto & login = cache.store_template(2, kind::login, &first, compiled_template());
+	assert_true(cache.find_template(2, kind::login, &first) == &login);
+	assert_true(cache.find_template(2, kind::status, &first) == nullptr);
+	assert_true(cache.find_template(1, kind::login, &first) == nullptr);
+	for (unsigned long gen = 3; gen < 3 + status_cache::max_generations; gen++)
+		cache.store_template(gen, kind::login, &first, compiled_template());
+	assert_true(cache.find_template(2, kind::login, &first) == nullptr);
+	cache.store_template(1, kind::status, &second, compiled_template());
+	assert_true(cache.find_template(1, kind::status, &second) != nullptr);
+	assert_true(cache.find_template(3, kind::login, &first) == nullptr);
+	assert_true(cache.find_template(2 + status_cache::max_generations, kind::login, &first) != nullptr);
+
+	// Changes of these files republish the configuration
+	assert_true(watched_file("./default/status.json"));
+	assert_true(watched_file("lobby/login.json"));
+	assert_false(watched_file("/srv/default/status.json"));
+	assert_false(watched_file("./default/nested/status.json"));
+	assert_false(watched_file("../default/status.json"));
+	assert_false(watched_file("./default/motd.txt"));
+	assert_false(watched_file("status.json"));
+}
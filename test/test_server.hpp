@@ -9,6 +9,10 @@
 #include <filesystem>
 #include <fstream>
 #include <forward_list>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <vector>
 
 #include <yaml-cpp/yaml.h>
 
@@ -66,6 +70,36 @@ YAML::Node base_record2yaml(const settings::basic_record & record) {
 		}
 		node["vars"] = vars;
 	}
+	if (!record.upstreams.empty()) {
+		YAML::Node upstreams;
+		for (auto & each : record.upstreams) {
+			YAML::Node upstream;
+			insert_str(upstream, address, each);
+			insert_int(upstream, port, each);
+			insert(upstream, weight, each);
+			upstreams.push_back(upstream);
+		}
+		node["upstreams"] = upstreams;
+	}
+	switch (record.balance) {
+		case settings::balance_t::least_conn:
+			node["balance"] = "least_conn";
+			break;
+		case settings::balance_t::hash:
+			node["balance"] = "hash";
+			break;
+		default:
+			break;
+	}
+	insert_int(node, status_ttl, record);
+	insert_bool(node, aggregate, record, false);
+	if (record.pool.max_idle) {
+		YAML::Node pool;
+		insert_int(pool, min_idle, record.pool);
+		insert_int(pool, max_idle, record.pool);
+		insert_int(pool, max_age, record.pool);
+		node["pool"] = pool;
+	}
 	return node;
 }
 
@@ -86,6 +120,21 @@ YAML::Node settings2yaml(const settings & config) {
 	if (def_serv.size() != 0)
 		node["default"] = def_serv;
 	insert_bool(node, dns_cache, config, true);
+	insert_int(node, dns_ttl, config);
+	insert_int(node, dns_negative_ttl, config);
+	insert_int(node, health_interval, config);
+	insert_int(node, health_timeout, config);
+	insert_int(node, health_fails, config);
+	insert_bool(node, splice, config, true);
+	insert_int(node, high_watermark, config);
+	insert_int(node, low_watermark, config);
+	if (config.io_backend == settings::io_backend_t::uring)
+		node["io_backend"] = "uring";
+	insert_int(node, uring_buffers, config);
+	insert_int(node, handshake_timeout, config);
+	insert_int(node, idle_timeout, config);
+	insert_str(node, metrics_address, config);
+	insert_int(node, metrics_port, config);
 	insert_str(node, domain, config);
 	insert_str(node, log, config);
 	insert_int(node, max_packet_size, config);
@@ -192,6 +241,87 @@ public:
 	sclient client() {
 		return sclient("localhost", portn);
 	}
+	// Sends a console command and returns the lines it printed
+	std::vector<std::string> command(const std::string & line, std::size_t count) {
+		input.writeln(line);
+		std::vector<std::string> result;
+		std::string text;
+		while (result.size() < count) {
+			if (errors.readln(text)) {
+				result.push_back(text);
+				text.clear();
+			}
+		}
+		return result;
+	}
+	// Value of a counter printed by the 'io' command
+	unsigned long long io_counter(const std::string & name) {
+		unsigned long long value = 0;
+		for (const std::string & line : command("io", io_lines))
+			if (line.compare(0, name.size() + 2, name + ": ") == 0)
+				value = std::stoull(line.substr(name.size() + 2));
+		return value;
+	}
+	static constexpr std::size_t io_lines = 8;
+};
+
+// Serialized packets for tests that write several of them at once
+template <typename P>
+void append_paket(std::vector<ekutils::byte_t> & output, const P & packet) {
+	std::size_t size = packet.size() + 10, old = output.size();
+	output.resize(old + size);
+	int written = packet.write(output.data() + old, size);
+	output.resize(old + std::size_t(written < 0 ? 0 : written));
+}
+
+// Backend that sends every received byte back
+class echo_backend {
+	ekutils::tcp_listener_d listener;
+	std::thread acceptor;
+	std::mutex mutex;
+	std::vector<std::thread> peers;
+	std::atomic<bool> working { true };
+
+	static void serve(ekutils::tcp_socket_d && sock) {
+		ekutils::byte_t buffer[16384];
+		while (true) {
+			int got = sock.read(buffer, sizeof(buffer));
+			if (got <= 0)
+				return;
+			for (int sent = 0; sent < got;) {
+				int written = sock.write(buffer + sent, std::size_t(got - sent));
+				if (written <= 0)
+					return;
+				sent += written;
+			}
+		}
+	}
+
+public:
+	echo_backend() {
+		listener.listen("127.0.0.1", 0);
+		listener.start();
+		acceptor = std::thread([this]() {
+			while (true) {
+				ekutils::tcp_socket_d sock = listener.accept();
+				if (!working)
+					return;
+				std::lock_guard lock(mutex);
+				peers.emplace_back(serve, std::move(sock));
+			}
+		});
+	}
+	~echo_backend() {
+		working = false;
+		// Wake up the acceptor
+		ekutils::tcp_socket_d wake(ekutils::connection_info::resolve("127.0.0.1", port()));
+		acceptor.join();
+		for (auto & peer : peers)
+			peer.join();
+	}
+	std::uint16_t port() const {
+		return listener.local_endpoint().port();
+	}
 };
 
 mcshub::mcshub(const arguments_t & args, const std::shared_ptr<confset> & dir, int streams,
@@ -0,0 +1,68 @@
+#include <thread>
+
+#include <sys/socket.h>
+
+#include "test_server.hpp"
+#include "test.hpp"
+
+test {
+	using namespace mcshub;
+	using namespace std::chrono_literals;
+	// Backend that reads nothing until the tunnel is throttled
+	ekutils::tcp_listener_d listener;
+	listener.listen("127.0.0.1", 0);
+	listener.start();
+	auto dir = confset::create();
+	settings conf;
+	conf.high_watermark = 65536;
+	conf.low_watermark = 16384;
+	auto & record = conf.servers["slow"];
+	record.address = "127.0.0.1";
+	record.port = listener.local_endpoint().port();
+	dir->mk_config(conf);
+	mcshub::mcshub server(dir, ekutils::stream::in | ekutils::stream::err);
+
+	pakets::handshake hs;
+	hs.version() = 578;
+	hs.address() = "slow";
+	hs.port() = server.port();
+	hs.state() = 2;
+	pakets::login login;
+	login.name() = "streamer";
+	std::vector<ekutils::byte_t> bytes;
+	append_paket(bytes, hs);
+	append_paket(bytes, login);
+	ekutils::tcp_socket_d client(ekutils::connection_info::resolve("localhost", server.port()));
+	assert_equals(int(bytes.size()), client.write(bytes.data(), bytes.size()));
+	ekutils::tcp_socket_d backend = listener.accept();
+	timeval tv { 10, 0 };
+	setsockopt(backend.get_handle(), SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+	// Client writes until the hub stops reading from it
+	client.set_non_block();
+	std::vector<ekutils::byte_t> chunk(65536, 'x');
+	std::size_t sent = 0;
+	for (int stalls = 0; stalls < 5;) {
+		int written = client.write(chunk.data(), chunk.size());
+		if (written > 0) {
+			sent += std::size_t(written);
+			stalls = 0;
+		} else {
+			stalls++;
+			std::this_thread::sleep_for(100ms);
+		}
+	}
+	assert_true(sent > std::size_t(conf.high_watermark));
+	assert_equals(1ull, server.io_counter("throttled gates"));
+	assert_true(server.io_counter("throttle events") >= 1);
+
+	// Reading from the backend resumes the tunnel, nothing is lost
+	std::size_t expected = bytes.size() + sent, received = 0;
+	while (received < expected) {
+		int got = backend.read(chunk.data(), chunk.size());
+		assert_true(got > 0);
+		received += std::size_t(got);
+	}
+	assert_equals(expected, received);
+	assert_equals(0ull, server.io_counter("throttled gates"));
+}
@@ -0,0 +1,130 @@
+#include "test.hpp"
+
+#include <memory>
+#include <vector>
+
+#include "timer_wheel.hpp"
+
+test {
+	using namespace mcshub;
+	using namespace std::chrono_literals;
+	typedef timer_wheel::clock clock;
+	constexpr auto tick = 1ms;
+	// Every wheel is expired ahead of the real clock, so each case gets its own
+	{
+		// Delays from every level of the wheel and beyond it
+		timer_wheel wheel(tick);
+		const std::vector<std::chrono::milliseconds> delays {
+			1ms, 5ms, 63ms, 64ms, 65ms, 1000ms, 4095ms, 4096ms, 5000ms, 300000ms, 20000000ms
+		};
+		std::vector<int> fired(delays.size(), 0);
+		std::vector<std::unique_ptr<timer_wheel::timer>> timers;
+		for (std::size_t i = 0; i < delays.size(); i++) {
+			timers.push_back(std::make_unique<timer_wheel::timer>([&fired, i]() { fired[i]++; }));
+			// Never earlier than the deadline, at most a tick later
+			auto start = clock::now();
+			wheel.arm(*timers[i], delays[i]);
+			wheel.expire(start + delays[i] - tick);
+			assert_equals(0, fired[i]);
+			assert_true(timers[i]->armed());
+			wheel.expire(start + delays[i] + 2 * tick);
+			assert_equals(1, fired[i]);
+			assert_false(timers[i]->armed());
+		}
+		assert_true(wheel.empty());
+	}
+	{
+		// All levels at once
+		timer_wheel wheel(tick);
+		int fired = 0;
+		std::vector<std::unique_ptr<timer_wheel::timer>> timers;
+		auto start = clock::now();
+		for (long delay = 1; delay < 100000; delay = delay * 3 / 2 + 1) {
+			timers.push_back(std::make_unique<timer_wheel::timer>([&fired]() { fired++; }));
+			wheel.arm(*timers.back(), std::chrono::milliseconds(delay));
+		}
+		assert_equals(timers.size(), wheel.size());
+		assert_equals(timers.size(), wheel.expire(start + 100001ms));
+		assert_equals(int(timers.size()), fired);
+	}
+	{
+		// Cancelled and destroyed timers never fire
+		timer_wheel wheel(tick);
+		int count = 0;
+		timer_wheel::timer cancelled([&count]() { count++; });
+		wheel.arm(cancelled, 10ms);
+		cancelled.cancel();
+		{
+			timer_wheel::timer gone([&count]() { count++; });
+			wheel.arm(gone, 10ms);
+			assert_equals(1u, wheel.size());
+		}
+		assert_true(wheel.empty());
+		assert_equals(0u, wheel.expire(clock::now() + 1s));
+		assert_equals(0, count);
+	}
+	{
+		// Rearming moves the deadline
+		timer_wheel wheel(tick);
+		int count = 0;
+		timer_wheel::timer moved([&count]() { count++; });
+		auto start = clock::now();
+		wheel.arm(moved, 10ms);
+		wheel.arm(moved, 100ms);
+		assert_equals(1u, wheel.size());
+		wheel.expire(start + 50ms);
+		assert_equals(0, count);
+		wheel.expire(start + 102ms);
+		assert_equals(1, count);
+	}
+	{
+		// Actions can rearm themselves and cancel other timers
+		timer_wheel wheel(tick);
+		int count = 0, periods = 0;
+		timer_wheel::timer victim([&count]() { count++; });
+		timer_wheel::timer periodic;
+		periodic.bind([&]() {
+			periods++;
+			victim.cancel();
+			if (periods < 5)
+				wheel.arm(periodic, 20ms);
+		});
+		auto start = clock::now();
+		wheel.arm(periodic, 20ms);
+		wheel.arm(victim, 25ms);
+		wheel.expire(start + 1s);
+		assert_equals(5, periods);
+		assert_equals(0, count);
+		assert_true(wheel.empty());
+	}
+	{
+		// Wheel wakes up for the next slot with timers only
+		timer_wheel wheel(tick);
+		assert_true(wheel.next_deadline() == clock::time_point::max());
+		timer_wheel::timer near, far;
+		auto start = clock::now();
+		wheel.arm(far, 300000ms);
+		auto armed = clock::now();
+		assert_true(wheel.next_deadline() > start + 1000ms);
+		assert_true(wheel.next_deadline() <= armed + 300000ms + tick);
+		wheel.arm(near, 10ms);
+		armed = clock::now();
+		assert_true(wheel.next_deadline() >= start + 10ms);
+		assert_true(wheel.next_deadline() <= armed + 10ms + tick);
+		wheel.expire(armed + 20ms);
+		assert_false(near.armed());
+		assert_true(wheel.next_deadline() > start + 1000ms);
+		far.cancel();
+		assert_true(wheel.next_deadline() == clock::time_point::max());
+	}
+	{
+		// Timers outlive the wheel
+		timer_wheel::timer orphan;
+		{
+			timer_wheel wheel(tick);
+			wheel.arm(orphan, 1s);
+			assert_true(orphan.armed());
+		}
+		assert_false(orphan.armed());
+	}
+}
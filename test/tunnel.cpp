@@ -0,0 +1,116 @@
+#include <system_error>
+
+#include "test_server.hpp"
+#include "test.hpp"
+
+#include "uring.hpp"
+
+// Established tunnels pass packets both ways unchanged with splice(2),
+// with buffered forwarding and on io_uring
+
+void echo_session(std::uint16_t port) {
+	using namespace mcshub;
+	sclient client("localhost", port);
+	client.set_timeout(std::chrono::seconds(10));
+	pakets::handshake hs;
+	hs.version() = 578;
+	hs.address() = "echo";
+	hs.port() = port;
+	hs.state() = 2;
+	client.write_paket(hs);
+	pakets::login login;
+	login.name() = "tester";
+	client.write_paket(login);
+	// Backend sends the handshake and the login back
+	pakets::handshake hs_echo;
+	client.read_paket(hs_echo);
+	assert_equals("echo", hs_echo.address());
+	pakets::login login_echo;
+	client.read_paket(login_echo);
+	assert_equals("tester", login_echo.name());
+	for (int i = 0; i < 128; i++) {
+		pakets::response payload, echoed;
+		payload.message() = std::string(16384, char('a' + i % 26));
+		client.write_paket(payload);
+		client.read_paket(echoed);
+		assert_true(echoed.message() == payload.message());
+	}
+}
+
+// Bytes sent together with the login are read during the handshake, they
+// reach the backend without waiting for more data from the client
+void pipelined_session(std::uint16_t port) {
+	using namespace mcshub;
+	pakets::handshake hs;
+	hs.version() = 578;
+	hs.address() = "echo";
+	hs.port() = port;
+	hs.state() = 2;
+	pakets::login login;
+	login.name() = "pipeliner";
+	pakets::response early, late, echoed;
+	early.message() = "sent with the login";
+	late.message() = std::string(16384, 'z');
+	std::vector<ekutils::byte_t> bytes;
+	append_paket(bytes, hs);
+	append_paket(bytes, login);
+	append_paket(bytes, early);
+	ekutils::tcp_socket_d sock(ekutils::connection_info::resolve("localhost", port));
+	assert_equals(int(bytes.size()), sock.write(bytes.data(), bytes.size()));
+	sclient client(std::move(sock));
+	client.set_timeout(std::chrono::seconds(10));
+	client.read_paket(hs);
+	client.read_paket(login);
+	assert_equals("pipeliner", login.name());
+	client.read_paket(echoed);
+	assert_equals(early.message(), echoed.message());
+	client.write_paket(late);
+	client.read_paket(echoed);
+	assert_true(echoed.message() == late.message());
+}
+
+bool uring_supported() {
+	try {
+		mcshub::uring probe(8, 8);
+		return true;
+	} catch (const std::system_error & e) {
+		std::cout << "io_uring is not available: " << e.what() << std::endl;
+		return false;
+	}
+}
+
+enum class forwarding {
+	splice, buffered, ring
+};
+
+test {
+	using namespace mcshub;
+	echo_backend backend;
+	for (forwarding mode : { forwarding::splice, forwarding::buffered, forwarding::ring }) {
+		if (mode == forwarding::ring && !uring_supported())
+			continue;
+		auto dir = confset::create();
+		settings conf;
+		conf.splice = mode == forwarding::splice;
+		if (mode == forwarding::ring)
+			conf.io_backend = settings::io_backend_t::uring;
+		auto & record = conf.servers["echo"];
+		record.address = "127.0.0.1";
+		record.port = backend.port();
+		dir->mk_config(conf);
+		mcshub::mcshub server(dir, ekutils::stream::in | ekutils::stream::err);
+		echo_session(server.port());
+		echo_session(server.port());
+		pipelined_session(server.port());
+		auto spliced = server.io_counter("spliced bytes");
+		if (mode == forwarding::splice)
+			assert_true(spliced >= 2 * 128 * 16384);
+		else
+			assert_equals(0ull, spliced);
+		auto ringed = server.io_counter("ring tunnels");
+		if (mode == forwarding::ring)
+			assert_true(ringed >= 1);
+		else
+			assert_equals(0ull, ringed);
+	}
+}
@@ -0,0 +1,109 @@
+#include "test.hpp"
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <system_error>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "uring.hpp"
+
+std::vector<mcshub::uring::completion> complete(mcshub::uring & ring, unsigned count) {
+	std::vector<mcshub::uring::completion> result;
+	while (result.size() < count) {
+		ring.submit(unsigned(count - result.size()));
+		ring.for_each_completion([&result](const mcshub::uring::completion & c) {
+			result.push_back(c);
+		});
+	}
+	return result;
+}
+
+test {
+	using namespace mcshub;
+	std::unique_ptr<uring> probe;
+	try {
+		probe = std::make_unique<uring>(8, 2);
+	} catch (const std::system_error & e) {
+		std::cout << "io_uring is not available: " << e.what() << std::endl;
+		return;
+	}
+	uring & ring = *probe;
+	assert_equals(2u, ring.free_buffers());
+	int pair[2];
+	assert_equals(0, socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, pair));
+
+	// Received bytes are in the provided buffer and are sent from it
+	const std::string message = "ring bytes";
+	assert_equals(long(message.size()), long(::write(pair[0], message.data(), message.size())));
+	ring.prepare_recv(pair[1], 1);
+	auto received = complete(ring, 1);
+	assert_equals(1ull, received[0].data);
+	assert_equals(int(message.size()), received[0].result);
+	assert_true(received[0].buffer >= 0);
+	assert_equals(1u, ring.free_buffers());
+	const auto * bytes = ring.buffer(received[0].buffer);
+	assert_equals(message, std::string(bytes, bytes + received[0].result));
+	ring.prepare_send(pair[1], bytes, message.size(), 2);
+	auto sent = complete(ring, 1);
+	assert_equals(2ull, sent[0].data);
+	assert_equals(int(message.size()), sent[0].result);
+	char echoed[64];
+	long got = long(::read(pair[0], echoed, sizeof(echoed)));
+	assert_equals(message, std::string(echoed, got < 0 ? 0 : std::size_t(got)));
+	ring.recycle(received[0].buffer);
+	assert_equals(2u, ring.free_buffers());
+
+	// Receive waits for bytes without holding a buffer, fails when all
+	// buffers are taken
+	ring.prepare_recv(pair[1], 3);
+	ring.submit(0);
+	assert_equals(long(message.size()), long(::write(pair[0], message.data(), message.size())));
+	auto first = complete(ring, 1);
+	assert_equals(3ull, first[0].data);
+	assert_true(first[0].buffer >= 0);
+	assert_equals(long(message.size()), long(::write(pair[0], message.data(), message.size())));
+	ring.prepare_recv(pair[1], 4);
+	auto second = complete(ring, 1);
+	assert_true(second[0].buffer >= 0);
+	assert_true(second[0].buffer != first[0].buffer);
+	assert_equals(0u, ring.free_buffers());
+	assert_equals(long(message.size()), long(::write(pair[0], message.data(), message.size())));
+	ring.prepare_recv(pair[1], 5);
+	auto starved = complete(ring, 1);
+	assert_equals(-ENOBUFS, starved[0].result);
+	ring.recycle(first[0].buffer);
+	ring.recycle(second[0].buffer);
+
+	// Readiness of other descriptors, epoll one in the workers
+	int event = eventfd(0, EFD_NONBLOCK);
+	ring.prepare_poll(event, POLLIN, 6);
+	ring.submit(0);
+	std::uint64_t one = 1;
+	assert_equals(long(sizeof(one)), long(::write(event, &one, sizeof(one))));
+	auto polled = complete(ring, 1);
+	assert_equals(6ull, polled[0].data);
+	assert_true(polled[0].result & POLLIN);
+
+	// Completions of everything in flight fit in the completion ring,
+	// a full submission ring is flushed on the way
+	unsigned pending = 0;
+	while (pending < 1000 && ring.prepare_recv(pair[0], 100 + pending))
+		pending++;
+	assert_equals(8u * 4 - uring::reserved_slots, pending);
+	assert_false(ring.prepare_send(pair[0], message.data(), message.size(), 7));
+	assert_true(ring.prepare_poll(event, POLLIN, 8));
+
+	// Pending operations don't hold the destruction
+	ring.submit(0);
+	probe.reset();
+
+	assert_fails({ uring(8, 3); });
+	::close(event);
+	::close(pair[0]);
+	::close(pair[1]);
+}
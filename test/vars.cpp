@@ -32,6 +32,16 @@ test {
 	log_debug(c5);
 	std::string c6 = man.resolve("image ${img:/img_vars_f.txt} end");
 	assert_equals("image data:image/png;base64,dGV4dA== end", c6);
+	auto tmpl = man.compile("port ${ hs:port }, ${lol:kek} $uuid$");
+	assert_true(tmpl.uses(man.ns_index<pakets::handshake>()));
+	assert_false(tmpl.uses(man.ns_index<img_vars>()));
+	assert_true(tmpl.uses(man.ns_index<main_vars_t>(), "uuid"));
+	assert_equals(-2, man.ns_index<file_vars>());
+	hs.port() = 25565;
+	std::string c7 = man.render(tmpl);
+	assert_equals(std::string("port 25565, { NO NSPA } ") + c7.substr(c7.size() - 37), c7);
+	hs.port() = 25566;
+	assert_equals(0u, man.render(tmpl).find("port 25566, "));
 	srand(65443);
 	for (int i = 0; i < 10; i++) {
 		std::string id = ekutils::uuid::random();